@@ -0,0 +1,62 @@
+/*
+ * backend.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+
+/*
+ * Hardware access used by the driver, so the register and DMA paths can run either on
+ * the real peripherals or against a simulation of them.
+ *
+ *   map_device    Map a peripheral register block, by its ARM physical address.
+ *   unmap_device  Undo map_device.
+ *   pages_to_bus  Bus addresses the DMA uses for a run of pages, starting at a page
+ *                 aligned userspace virtual address.  0 on success, -1 on error.
+ *   destroy       Release the backend and anything it still holds.
+ */
+typedef struct backend
+{
+    void *(*map_device)(struct backend *backend, const uint32_t phys, const uint32_t len);
+    void (*unmap_device)(struct backend *backend, volatile void *addr, const uint32_t len);
+    int (*pages_to_bus)(struct backend *backend, const volatile void *addr, uint32_t pages,
+                        uint32_t *bus);
+    void (*destroy)(struct backend *backend);
+    void *priv;
+} backend_t;
+
+
+backend_t *hw_backend_create(void);
+
+backend_t *sim_backend_create(int paced);
+const uint32_t *sim_fifo_capture(backend_t *backend, uint32_t *count);
+const uint32_t *sim_gpio_capture(backend_t *backend, uint32_t *count);
+
+
+#endif /* __BACKEND_H__ */
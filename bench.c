@@ -0,0 +1,280 @@
+/*
+ * bench.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Encoder and frame pipeline benchmark.  Each case drives the library against the
+ * unpaced simulator backend, so no hardware or root is needed, changes every LED
+ * between frames so the whole frame is encoded, and waits for the previous frame
+ * outside the timed region so only the render path itself is measured.
+ *
+ * Results are written to stdout as JSON, progress to stderr:
+ *
+ *     ./bench [max_leds] > bench.json
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ws2811.h"
+#include "timing.h"
+
+
+#define ARRAY_SIZE(stuff)                        (sizeof(stuff) / sizeof(stuff[0]))
+
+#define BENCH_DMA                                5
+#define BENCH_GPIO0                              18
+#define BENCH_GPIO1                              13
+#define BENCH_TARGET_NS                          50000000     // Time spent on each case
+#define BENCH_MIN_ITERATIONS                     5
+#define BENCH_MAX_ITERATIONS                     2000
+
+
+
+typedef struct
+{
+    int encoder;
+    const char *name;
+} bench_encoder_t;
+
+static const bench_encoder_t encoders[] =
+{
+    { WS2811_ENCODER_REFERENCE, "reference" },
+    { WS2811_ENCODER_TABLE,     "table" },
+    { WS2811_ENCODER_SIMD,      "simd" },
+};
+
+static const int led_counts[] = { 10, 100, 1000, 10000, 100000 };
+static const int brightnesses[] = { 255, 128 };
+static const uint32_t freqs[] = { 800000, 400000 };
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Fill every LED with a colour that differs from the one it had last frame, so the
+ * dirty tracking has to encode the whole frame.
+ */
+static void bench_fill(ws2811_t *ws2811, uint32_t frame)
+{
+    int chan, i;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+
+        for (i = 0; i < channel->count; i++)
+        {
+            channel->leds[i] = ((i * 2654435761U) + (frame * 0x9e3779b9U)) & 0xffffff;
+        }
+    }
+}
+
+/**
+ * Wait for the simulated DMA to go idle without sleeping until the wire deadline.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int bench_idle(ws2811_t *ws2811)
+{
+    int ret;
+
+    while ((ret = ws2811_try_wait(ws2811)) > 0)
+    {
+        usleep(10);
+    }
+
+    return ret;
+}
+
+/**
+ * Time ws2811_render() for one configuration and print it as a JSON object.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int bench_case(const bench_encoder_t *encoder, int leds, int channels, int invert,
+                      int brightness, uint32_t freq, int first)
+{
+    static uint64_t times[BENCH_MAX_ITERATIONS];
+    ws2811_t ws2811;
+    timing_t timing;
+    uint64_t start, median, wire_ns;
+    int iterations, total, chan, i;
+
+    memset(&ws2811, 0, sizeof(ws2811));
+    ws2811.freq = freq;
+    ws2811.dmanum = BENCH_DMA;
+    ws2811.backend = WS2811_BACKEND_SIM_UNPACED;
+    ws2811.encoder = encoder->encoder;
+
+    for (chan = 0; chan < channels; chan++)
+    {
+        ws2811.channel[chan].gpionum = chan ? BENCH_GPIO1 : BENCH_GPIO0;
+        ws2811.channel[chan].count = leds;
+        ws2811.channel[chan].invert = invert;
+        ws2811.channel[chan].brightness = brightness;
+    }
+
+    // Same sizes as the library works out for this profile
+    if (timing_resolve(ws2811.timing, ws2811.freq, &timing) || ws2811_init(&ws2811))
+    {
+        return -1;
+    }
+
+    // Untimed warm up frame, which also builds the symbol tables
+    bench_fill(&ws2811, 0);
+    start = now_ns();
+    if (ws2811_render(&ws2811) || bench_idle(&ws2811))
+    {
+        goto err;
+    }
+
+    iterations = BENCH_TARGET_NS / ((now_ns() - start) + 1);
+    if (iterations < BENCH_MIN_ITERATIONS)
+    {
+        iterations = BENCH_MIN_ITERATIONS;
+    }
+    if (iterations > BENCH_MAX_ITERATIONS)
+    {
+        iterations = BENCH_MAX_ITERATIONS;
+    }
+
+    total = leds * channels;
+    for (i = 0; i < iterations; i++)
+    {
+        bench_fill(&ws2811, i + 1);
+
+        start = now_ns();
+        if (ws2811_render(&ws2811))
+        {
+            goto err;
+        }
+        times[i] = now_ns() - start;
+
+        if ((ws2811.encoded != total) || bench_idle(&ws2811))
+        {
+            goto err;
+        }
+    }
+
+    ws2811_fini(&ws2811);
+
+    qsort(times, iterations, sizeof(times[0]), cmp_u64);
+    median = times[iterations / 2];
+    wire_ns = timing_frame_ns(&timing, leds);
+
+    printf("%s    {\"encoder\": \"%s\", \"leds\": %d, \"channels\": %d, \"invert\": %d, "
+           "\"brightness\": %d, \"freq\": %u, \"iterations\": %d, "
+           "\"render_ns\": %llu, \"render_min_ns\": %llu, \"ns_per_led\": %.3f, "
+           "\"buffer_bytes\": %u, \"mb_per_s\": %.1f, \"max_fps\": %.1f, \"wire_fps\": %.1f}",
+           first ? "" : ",\n", encoder->name, leds, channels, invert, brightness,
+           (unsigned)freq, iterations,
+           (unsigned long long)median, (unsigned long long)times[0],
+           (double)median / total,
+           timing_byte_count(&timing, leds),
+           ((double)total * 3 * timing.symbols * 1000) / median,
+           1e9 / median,
+           1e9 / wire_ns);
+    fflush(stdout);
+
+    return 0;
+
+err:
+    ws2811_fini(&ws2811);
+
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int max_leds = argc > 1 ? atoi(argv[1]) : 0;
+    int first = 1;
+    size_t e, l, b, f;
+    int channels, invert;
+
+    printf("{\"benchmark\": \"ws2811_render\", \"results\": [\n");
+
+    for (e = 0; e < ARRAY_SIZE(encoders); e++)
+    {
+        for (l = 0; l < ARRAY_SIZE(led_counts); l++)
+        {
+            if (max_leds && (led_counts[l] > max_leds))
+            {
+                continue;
+            }
+
+            fprintf(stderr, "%s: %d leds\n", encoders[e].name, led_counts[l]);
+
+            for (channels = 1; channels <= RPI_PWM_CHANNELS; channels++)
+            {
+                for (invert = 0; invert <= 1; invert++)
+                {
+                    for (b = 0; b < ARRAY_SIZE(brightnesses); b++)
+                    {
+                        for (f = 0; f < ARRAY_SIZE(freqs); f++)
+                        {
+                            if (bench_case(&encoders[e], led_counts[l], channels, invert,
+                                           brightnesses[b], freqs[f], first))
+                            {
+                                fprintf(stderr, "%s: %d leds: failed\n",
+                                        encoders[e].name, led_counts[l]);
+                                return -1;
+                            }
+
+                            first = 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("\n]}\n");
+
+    return 0;
+}
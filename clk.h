@@ -56,5 +56,8 @@ typedef struct {
 
 #define CM_PWM                                   (0x201010a0)  // 0x7e1010a0
 
+#define OSC_FREQ                                 19200000   // crystal frequency
+#define PLLD_FREQ                                500000000  // PLLD peripheral clock
+
 
 #endif /* __CLK_H__ */
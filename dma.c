@@ -39,6 +39,7 @@
 #include <sys/mman.h>
 
 #include "dma.h"
+#include "backend.h"
 
 
 // DMA address mapping by DMA number index
@@ -75,113 +76,229 @@ uint32_t dmanum_to_phys(int dmanum)
     return dma_addr[dmanum];
 }
 
-
-dma_page_t *dma_page_add(dma_page_t *head, void *addr)
+/**
+ * Largest transfer a single control block can do on a DMA channel.
+ *
+ * @param    dmanum  DMA channel number.
+ *
+ * @returns  Length in bytes, a whole number of words.
+ */
+uint32_t dmanum_max_txfr_len(int dmanum)
 {
-    dma_page_t *page = malloc(sizeof(dma_page_t));
-
-    if (!page)
+    if ((dmanum >= DMA_LITE_FIRST) && (dmanum <= DMA_LITE_LAST))
     {
-        return NULL;
+        return DMA_LITE_MAX_TXFR_LEN;
     }
 
-    page->next = head;
-    page->prev = head->prev;
+    return DMA_MAX_TXFR_LEN;
+}
 
-    head->prev->next = page;
-    head->prev = page;
 
-    page->addr = addr;
+/**
+ * Get the default huge page size from /proc/meminfo.
+ *
+ * @returns  Huge page size in bytes, 0 if huge pages are not supported.
+ */
+static uint32_t huge_page_size(void)
+{
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    char line[128];
+    unsigned long kb = 0;
 
-    return page;
-}
+    if (!meminfo)
+    {
+        return 0;
+    }
 
-void dma_page_remove(dma_page_t *page)
-{
-    page->prev->next = page->next;
-    page->next->prev = page->prev;
+    while (fgets(line, sizeof(line), meminfo))
+    {
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+        {
+            break;
+        }
+    }
+
+    fclose(meminfo);
 
-    free(page);
+    return kb * 1024;
 }
 
-void dma_page_remove_all(dma_page_t *head)
+/**
+ * Map memory from the huge page pool.  Each huge page is physically contiguous, so a
+ * buffer needs far fewer control blocks and TLB entries than with small pages.
+ *
+ * @param    size  Bytes needed, rounded up to whole huge pages.
+ *
+ * @returns  Pointer to the mapping, MAP_FAILED if no huge pages are available.
+ */
+static void *huge_page_map(uint32_t *size)
 {
-    while (head->next != head)
+    uint32_t huge_size = huge_page_size();
+    uint32_t len;
+    void *vaddr;
+
+    if (!huge_size)
     {
-        dma_page_remove(head->next);
+        return MAP_FAILED;
     }
-}
 
-dma_page_t *dma_page_next(dma_page_t *head, dma_page_t *page)
-{
-    if (page->next != head)
+    len = ((*size + huge_size - 1) / huge_size) * huge_size;
+
+    // No MAP_NORESERVE, so an empty pool fails here rather than with SIGBUS on access
+    vaddr = mmap(NULL, len,
+                 PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB |
+                 MAP_LOCKED, -1, 0);
+    if (vaddr != MAP_FAILED)
     {
-        return page->next;
+        *size = len;
     }
 
-    return NULL;
+    return vaddr;
 }
 
-void dma_page_init(dma_page_t *page)
+/**
+ * Allocate locked memory for the DMA to read and look up the bus address of each of
+ * its pages, all in one request to the backend.
+ *
+ * @param    backend  Backend that translates addresses.
+ * @param    mem      Filled in with the mapping and its page table.
+ * @param    size     Bytes needed.
+ * @param    flags    DMA_ALLOC_HUGE to use huge pages if there are any, falling back
+ *                    to normal pages if not.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+int dma_alloc(struct backend *backend, dma_mem_t *mem, uint32_t size, int flags)
 {
-    memset(page, 0, sizeof(*page));
+    uint32_t len = ((size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+    uint32_t *bus = NULL;
+    uint32_t pages;
+    uint8_t *vaddr = MAP_FAILED;
+    uint32_t i;
 
-    page->next = page;
-    page->prev = page;
-}
+    memset(mem, 0, sizeof(*mem));
 
-void *dma_alloc(dma_page_t *head, uint32_t size)
-{
-    uint32_t pages = (size / PAGE_SIZE) + 1;
-    uint8_t *vaddr;
-    int i;
+    if (flags & DMA_ALLOC_HUGE)
+    {
+        vaddr = huge_page_map(&len);
+        mem->huge = (vaddr != MAP_FAILED);
+    }
+
+    if (vaddr == MAP_FAILED)
+    {
+        vaddr = mmap(NULL, len,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE |
+                     MAP_LOCKED, -1, 0);
+    }
 
-    vaddr = mmap(NULL, pages * PAGE_SIZE,
-                 PROT_READ | PROT_WRITE,
-                 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE |
-                 MAP_LOCKED, -1, 0);
     if (vaddr == MAP_FAILED)
     {
         perror("dma_alloc() mmap() failed");
-        return NULL;
+        return -1;
+    }
+
+    pages = len / PAGE_SIZE;
+    mem->virt = vaddr;
+    mem->size = len;
+
+    mem->page = malloc(pages * sizeof(*mem->page));
+    bus = malloc(pages * sizeof(*bus));
+    if (!mem->page || !bus)
+    {
+        goto err;
+    }
+
+    if (backend->pages_to_bus(backend, vaddr, pages, bus))
+    {
+        goto err;
     }
 
     for (i = 0; i < pages; i++)
     {
-        if (!dma_page_add(head, &vaddr[PAGE_SIZE * i]))
-        {
-            dma_page_remove_all(head);
-            munmap(vaddr, pages * PAGE_SIZE);
-            return NULL;
-        }
+        mem->page[i].virt = &vaddr[PAGE_SIZE * i];
+        mem->page[i].bus = bus[i];
     }
+    mem->page_count = pages;
 
-    return vaddr;
+    free(bus);
+
+    return 0;
+
+err:
+    free(bus);
+    dma_free(mem);
+
+    return -1;
 }
 
-dma_cb_t *dma_desc_alloc(uint32_t descriptors)
+/**
+ * Release memory from dma_alloc().  Safe to call on a zeroed dma_mem_t.
+ *
+ * @param    mem  Memory to release.
+ *
+ * @returns  None
+ */
+void dma_free(dma_mem_t *mem)
 {
-    uint32_t pages = ((descriptors * sizeof(dma_cb_t)) / PAGE_SIZE) + 1;
-    dma_cb_t *vaddr;
-
-    vaddr = mmap(NULL, pages * PAGE_SIZE,
-                 PROT_READ | PROT_WRITE,
-                 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE |
-                 MAP_LOCKED, -1, 0);
-    if (vaddr == MAP_FAILED)
+    if (mem->virt)
     {
-        perror("dma_desc_alloc() mmap() failed");
-        return NULL;
+        munmap((void *)mem->virt, mem->size);
     }
 
-    return vaddr;
+    free(mem->page);
+    memset(mem, 0, sizeof(*mem));
 }
 
-void dma_page_free(void *buffer, const uint32_t size)
+/**
+ * Bus address of a byte offset into memory from dma_alloc().
+ *
+ * @param    mem     Memory from dma_alloc().
+ * @param    offset  Byte offset, must be inside the mapping.
+ *
+ * @returns  Bus address.
+ */
+uint32_t dma_bus_addr(const dma_mem_t *mem, uint32_t offset)
 {
-    uint32_t pages = (size / PAGE_SIZE) + 1;
-
-    munmap(buffer, pages * PAGE_SIZE);
+    return mem->page[offset / PAGE_SIZE].bus + PAGE_OFFSET(offset);
 }
 
+/**
+ * Find how many bytes from an offset into a page table are contiguous on the bus, and
+ * so can be moved by one control block.  Only looks at the table, so it can be fed
+ * made up addresses.
+ *
+ * @param    page        Page table.
+ * @param    page_count  Entries in the page table.
+ * @param    offset      Byte offset of the start of the run.
+ * @param    bytes       Bytes left to transfer from offset.
+ * @param    max_len     Largest transfer allowed, a whole number of words.
+ *
+ * @returns  Length of the run in bytes.
+ */
+uint32_t dma_contiguous_bytes(const dma_page_t *page, uint32_t page_count, uint32_t offset,
+                              uint32_t bytes, uint32_t max_len)
+{
+    uint32_t i = offset / PAGE_SIZE;
+    uint32_t len = PAGE_SIZE - PAGE_OFFSET(offset);
+
+    while ((len < bytes) && (len < max_len) && ((i + 1) < page_count) &&
+           (page[i + 1].bus == (page[i].bus + PAGE_SIZE)))
+    {
+        len += PAGE_SIZE;
+        i++;
+    }
+
+    if (len > bytes)
+    {
+        len = bytes;
+    }
+
+    if (len > max_len)
+    {
+        len = max_len;
+    }
 
+    return len;
+}
@@ -116,30 +116,49 @@ typedef struct
 #define DMA15                                    (0x20e05000)
 
 
+#define DMA_LITE_FIRST                           7             // DMA7 to DMA14 are lite
+#define DMA_LITE_LAST                            14
+#define DMA_MAX_TXFR_LEN                         0x3ffffffc    // 30-bit length, whole words
+#define DMA_LITE_MAX_TXFR_LEN                    0xfffc        // 16-bit length, whole words
+
+
+#define DMA_ALLOC_HUGE                           (1 << 0)      // Try huge pages first
+
+
 #define PAGE_SIZE                                (1 << 12)
 #define PAGE_MASK                                (~(PAGE_SIZE - 1))
 #define PAGE_OFFSET(page)                        (page & (PAGE_SIZE - 1))
 
 
-typedef struct dma_page
+typedef struct
 {
-    struct dma_page *next;
-    struct dma_page *prev;
-    void *addr;
+    volatile uint8_t *virt;
+    uint32_t bus;
 } dma_page_t;
 
+/*
+ * Memory the DMA can reach, with the virtual and bus address of every page.
+ */
+typedef struct
+{
+    volatile uint8_t *virt;                      // Start of the mapping
+    uint32_t size;                               // Mapped bytes, a page multiple
+    int huge;                                    // Backed by huge pages
+    dma_page_t *page;
+    uint32_t page_count;
+} dma_mem_t;
+
 
-uint32_t dmanum_to_phys(int dmanum);
+struct backend;
 
-void dma_page_init(dma_page_t *page);
-dma_page_t *dma_page_add(dma_page_t *head, void *addr);
-void dma_page_remove(dma_page_t *page);
-void dma_page_remove_all(dma_page_t *head);
-dma_page_t *dma_page_next(dma_page_t *head, dma_page_t *page);
+uint32_t dmanum_to_phys(int dmanum);
+uint32_t dmanum_max_txfr_len(int dmanum);
 
-void *dma_alloc(dma_page_t *head, uint32_t size);
-dma_cb_t *dma_desc_alloc(uint32_t descriptors);
-void dma_page_free(void *buffer, const uint32_t size);
+int dma_alloc(struct backend *backend, dma_mem_t *mem, uint32_t size, int flags);
+void dma_free(dma_mem_t *mem);
+uint32_t dma_bus_addr(const dma_mem_t *mem, uint32_t offset);
+uint32_t dma_contiguous_bytes(const dma_page_t *page, uint32_t page_count, uint32_t offset,
+                              uint32_t bytes, uint32_t max_len);
 
 
 #endif /* __DMA_H__ */
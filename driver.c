@@ -0,0 +1,420 @@
+/*
+ * driver.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "rt.h"
+
+#include "ws2811.h"
+#include "driver.h"
+
+
+/*
+ * Driver thread.  Frames are copied into queue slots by the producer and out of them
+ * into the channel LED buffers by the driver thread, which then renders them.  Since
+ * ws2811_render() waits for the previous frame, frames go out at the wire rate.
+ *
+ * The ring is single producer, single consumer.  head counts frames submitted and is
+ * only written by the producer.  tail counts frames taken or dropped.  The consumer
+ * takes a slot by copying it out and then moving tail on with a compare and swap.  With
+ * WS2811_QUEUE_DROP_OLDEST the producer may move tail on as well to free a slot; if that
+ * happens while the consumer is copying, the consumer's swap fails and it throws the
+ * copy away, so a slot that is being overwritten is never rendered.
+ *
+ * The mailbox is a triple buffer: the producer fills its back slot and swaps it with the
+ * middle one, the consumer swaps its front slot with the middle one when it is fresh.
+ */
+#define DRIVER_MAILBOX_SLOTS                     3
+#define DRIVER_MAILBOX_FRESH                     (1 << 8)  // Middle slot has a new frame
+#define DRIVER_MAILBOX_SLOT(val)                 ((val) & 0xff)
+
+
+typedef struct ws2811_driver
+{
+    ws2811_t *ws2811;
+    pthread_t thread;
+    int policy;                                  // WS2811_QUEUE_*
+    uint32_t depth;                              // Slots in use
+    ws2811_led_t *slot_mem;
+    ws2811_led_t *slot[WS2811_QUEUE_MAX_DEPTH][RPI_PWM_CHANNELS];
+    uint64_t head;                               // Frames submitted to the ring
+    uint64_t tail;                               // Frames taken from or dropped off the ring
+    uint32_t mailbox;                            // Middle slot and DRIVER_MAILBOX_FRESH
+    uint32_t back;                               // Slot the producer fills next, mailbox only
+    uint32_t front;                              // Slot the consumer took last, mailbox only
+    sem_t frames;                                // Posted for every submitted frame
+    sem_t space;                                 // Posted for every taken frame
+    int stop;
+    int failed;                                  // ws2811_render() failed, thread exited
+} ws2811_driver_t;
+
+
+/**
+ * Copy a frame into a queue slot.
+ *
+ * @param    driver  Driver instance pointer.
+ * @param    slot    Slot number.
+ * @param    leds    LEDs of each channel.
+ *
+ * @returns  None
+ */
+static void slot_fill(ws2811_driver_t *driver, uint32_t slot, ws2811_led_t *const leds[])
+{
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (leds[chan])
+        {
+            memcpy(driver->slot[slot][chan], leds[chan],
+                   sizeof(ws2811_led_t) * driver->ws2811->channel[chan].count);
+        }
+    }
+}
+
+/**
+ * Copy a queue slot into the channel LED buffers.
+ *
+ * @param    driver  Driver instance pointer.
+ * @param    slot    Slot number.
+ *
+ * @returns  None
+ */
+static void slot_copy_out(ws2811_driver_t *driver, uint32_t slot)
+{
+    ws2811_t *ws2811 = driver->ws2811;
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        memcpy(ws2811->channel[chan].leds, driver->slot[slot][chan],
+               sizeof(ws2811_led_t) * ws2811->channel[chan].count);
+    }
+}
+
+/**
+ * Take the next frame off the queue into the channel LED buffers.
+ *
+ * @param    driver  Driver instance pointer.
+ *
+ * @returns  1 if a frame was taken, 0 if there is none.
+ */
+static int driver_take(ws2811_driver_t *driver)
+{
+    uint64_t tail;
+
+    if (driver->policy == WS2811_QUEUE_MAILBOX)
+    {
+        uint32_t old;
+
+        if (!(__atomic_load_n(&driver->mailbox, __ATOMIC_ACQUIRE) & DRIVER_MAILBOX_FRESH))
+        {
+            return 0;
+        }
+
+        old = __atomic_exchange_n(&driver->mailbox, driver->front, __ATOMIC_ACQ_REL);
+        driver->front = DRIVER_MAILBOX_SLOT(old);
+        slot_copy_out(driver, driver->front);
+
+        return 1;
+    }
+
+    tail = __atomic_load_n(&driver->tail, __ATOMIC_ACQUIRE);
+    while (tail != __atomic_load_n(&driver->head, __ATOMIC_ACQUIRE))
+    {
+        slot_copy_out(driver, tail % driver->depth);
+
+        // Fails if the producer dropped this frame while it was being copied
+        if (__atomic_compare_exchange_n(&driver->tail, &tail, tail + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            if (driver->policy == WS2811_QUEUE_BLOCK)
+            {
+                sem_post(&driver->space);
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Driver thread main loop, renders every frame it takes until stopped.
+ *
+ * @param    arg  Driver instance pointer.
+ *
+ * @returns  NULL
+ */
+static void *driver_thread(void *arg)
+{
+    ws2811_driver_t *driver = arg;
+    ws2811_t *ws2811 = driver->ws2811;
+
+    if (ws2811->rt_priority)
+    {
+        rt_thread_setup(ws2811->rt_priority, ws2811->rt_cpus);
+    }
+
+    while (!__atomic_load_n(&driver->stop, __ATOMIC_ACQUIRE))
+    {
+        if (!driver_take(driver))
+        {
+            sem_wait(&driver->frames);
+            continue;
+        }
+
+        if (ws2811_render(ws2811))
+        {
+            __atomic_store_n(&driver->failed, 1, __ATOMIC_RELEASE);
+
+            // Don't leave a blocked producer waiting on a thread that is gone
+            sem_post(&driver->space);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Start a library owned thread that renders frames submitted with ws2811_submit().
+ * Once started, the application must not call ws2811_render() or touch the channel
+ * LED buffers itself.
+ *
+ * @param    ws2811  ws2811 instance pointer, initialized.
+ * @param    policy  WS2811_QUEUE_*, what happens when frames come faster than they go.
+ * @param    depth   Frames the ring holds, 1 to WS2811_QUEUE_MAX_DEPTH.  Ignored for
+ *                   WS2811_QUEUE_MAILBOX.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int ws2811_driver_start(ws2811_t *ws2811, int policy, int depth)
+{
+    ws2811_driver_t *driver;
+    size_t frame_leds = 0;
+    int chan, i;
+
+    if (ws2811->driver || (policy < WS2811_QUEUE_MAILBOX) || (policy > WS2811_QUEUE_BLOCK))
+    {
+        return -1;
+    }
+
+    if (policy == WS2811_QUEUE_MAILBOX)
+    {
+        depth = DRIVER_MAILBOX_SLOTS;
+    }
+    else if ((depth < 1) || (depth > WS2811_QUEUE_MAX_DEPTH))
+    {
+        return -1;
+    }
+
+    driver = calloc(1, sizeof(*driver));
+    if (!driver)
+    {
+        return -1;
+    }
+
+    driver->ws2811 = ws2811;
+    driver->policy = policy;
+    driver->depth = depth;
+    driver->back = 0;
+    driver->mailbox = 1;
+    driver->front = 2;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        frame_leds += ws2811->channel[chan].count;
+    }
+
+    // Slots start out as the current contents of the channels
+    driver->slot_mem = malloc(sizeof(ws2811_led_t) * (frame_leds * depth + 1));
+    if (!driver->slot_mem)
+    {
+        goto err;
+    }
+
+    for (i = 0; i < depth; i++)
+    {
+        ws2811_led_t *leds = &driver->slot_mem[frame_leds * i];
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            driver->slot[i][chan] = leds;
+            memcpy(leds, ws2811->channel[chan].leds,
+                   sizeof(ws2811_led_t) * ws2811->channel[chan].count);
+            leds += ws2811->channel[chan].count;
+        }
+    }
+
+    if (sem_init(&driver->frames, 0, 0))
+    {
+        goto err;
+    }
+
+    if (sem_init(&driver->space, 0, 0))
+    {
+        sem_destroy(&driver->frames);
+        goto err;
+    }
+
+    // The driver thread renders from now on and is the only real-time one, it must not
+    // inherit the caller's policy and affinity and share a core with it at equal priority
+    render_thread_release(ws2811);
+
+    if (pthread_create(&driver->thread, NULL, driver_thread, driver))
+    {
+        render_thread_claim(ws2811);
+        sem_destroy(&driver->space);
+        sem_destroy(&driver->frames);
+        goto err;
+    }
+
+    ws2811->driver = driver;
+
+    return 0;
+
+err:
+    free(driver->slot_mem);
+    free(driver);
+
+    return -1;
+}
+
+/**
+ * Stop the driver thread.  Frames still queued are dropped, the one being rendered is
+ * finished.  Called by ws2811_fini() as well.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+void ws2811_driver_stop(ws2811_t *ws2811)
+{
+    ws2811_driver_t *driver = ws2811->driver;
+
+    if (!driver)
+    {
+        return;
+    }
+
+    __atomic_store_n(&driver->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&driver->frames);
+    pthread_join(driver->thread, NULL);
+
+    sem_destroy(&driver->space);
+    sem_destroy(&driver->frames);
+    free(driver->slot_mem);
+    free(driver);
+
+    ws2811->driver = NULL;
+
+    // The caller renders again
+    render_thread_claim(ws2811);
+}
+
+/**
+ * Hand a frame to the driver thread.  The LEDs are copied, so the buffers can be reused
+ * as soon as this returns.  Only one thread may submit.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    leds    LEDs for each channel, count long, NULL for unused channels.
+ *
+ * @returns  0 if queued, 1 if the frame was dropped (WS2811_QUEUE_DROP_NEWEST), -1 if no
+ *           driver thread is running.
+ */
+int ws2811_submit(ws2811_t *ws2811, ws2811_led_t *const leds[RPI_PWM_CHANNELS])
+{
+    ws2811_driver_t *driver = ws2811->driver;
+    uint64_t head, tail;
+
+    if (!driver || __atomic_load_n(&driver->failed, __ATOMIC_ACQUIRE))
+    {
+        return -1;
+    }
+
+    if (driver->policy == WS2811_QUEUE_MAILBOX)
+    {
+        uint32_t old, next = driver->back;
+
+        slot_fill(driver, next, leds);
+        old = __atomic_exchange_n(&driver->mailbox, next | DRIVER_MAILBOX_FRESH,
+                                  __ATOMIC_ACQ_REL);
+        driver->back = DRIVER_MAILBOX_SLOT(old);
+
+        // The frame in the middle slot was never shown
+        if (old & DRIVER_MAILBOX_FRESH)
+        {
+            stats_frame_dropped(ws2811);
+        }
+
+        sem_post(&driver->frames);
+
+        return 0;
+    }
+
+    head = driver->head;
+    while (head - (tail = __atomic_load_n(&driver->tail, __ATOMIC_ACQUIRE)) >= driver->depth)
+    {
+        switch (driver->policy)
+        {
+            case WS2811_QUEUE_DROP_NEWEST:
+                stats_frame_dropped(ws2811);
+                return 1;
+
+            case WS2811_QUEUE_DROP_OLDEST:
+                if (__atomic_compare_exchange_n(&driver->tail, &tail, tail + 1, 0,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                {
+                    stats_frame_dropped(ws2811);
+                }
+                break;
+
+            default:
+                sem_wait(&driver->space);
+                if (__atomic_load_n(&driver->failed, __ATOMIC_ACQUIRE))
+                {
+                    return -1;
+                }
+                break;
+        }
+    }
+
+    slot_fill(driver, head % driver->depth, leds);
+    __atomic_store_n(&driver->head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&driver->frames);
+
+    return 0;
+}
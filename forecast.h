@@ -0,0 +1,141 @@
+/*
+ * forecast.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+
+#ifndef __FORECAST_H__
+#define __FORECAST_H__
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <endian.h>
+
+
+/*
+ * Forecast file read by the matrix demo.  A header followed by rows of fields, every value
+ * a little endian int32_t, so the file can be mapped and read in place.  The checksum
+ * covers the values.  forecast_pack writes it to a temporary file and renames that over
+ * the old one, so a reader never sees a file that is being written.
+ */
+#define FORECAST_MAGIC                           0x54534346   // FCST
+#define FORECAST_VERSION                         1
+
+#define FORECAST_FIELD_TEMP                      0            // Temperature, 0 to 9999
+#define FORECAST_FIELD_WIND                      1            // Wind speed
+#define FORECAST_FIELD_PRECIP                    2            // Precipitation
+#define FORECAST_FIELDS                          3            // Fields written, more are ignored
+
+
+typedef struct
+{
+    uint32_t magic;                              //< FORECAST_MAGIC
+    uint16_t version;                            //< FORECAST_VERSION
+    uint16_t header_size;                        //< Offset of the first row
+    uint32_t rows;                               //< Rows, one per matrix row from the top
+    uint32_t fields;                             //< Values per row
+    uint64_t timestamp;                          //< Seconds since the epoch it was written
+    uint32_t checksum;                           //< forecast_checksum() of the values
+    uint32_t reserved;
+} forecast_header_t;
+
+
+/*
+ * FNV-1a of the values.
+ */
+static inline uint32_t forecast_checksum(const void *values, size_t size)
+{
+    const uint8_t *p = values;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Check a mapped forecast file.
+ *
+ * @returns  The header, NULL if the file is not a complete forecast of a known version.
+ */
+static inline const forecast_header_t *forecast_check(const void *map, size_t size)
+{
+    const forecast_header_t *header = map;
+    size_t header_size, words, rows, fields;
+
+    if ((size < sizeof(*header)) || (le32toh(header->magic) != FORECAST_MAGIC) ||
+        (le16toh(header->version) != FORECAST_VERSION))
+    {
+        return NULL;
+    }
+
+    header_size = le16toh(header->header_size);
+    rows = le32toh(header->rows);
+    fields = le32toh(header->fields);
+    if ((header_size < sizeof(*header)) || (header_size % 4) || (header_size > size) ||
+        ((size - header_size) % sizeof(int32_t)))
+    {
+        return NULL;
+    }
+
+    // Divide rather than multiply, the counts come straight from the file
+    words = (size - header_size) / sizeof(int32_t);
+    if ((fields < FORECAST_FIELDS) || (fields > words) || (rows != words / fields) ||
+        (words % fields))
+    {
+        return NULL;
+    }
+
+    if (forecast_checksum((const uint8_t *)map + header_size, words * sizeof(int32_t)) !=
+        le32toh(header->checksum))
+    {
+        return NULL;
+    }
+
+    return header;
+}
+
+/*
+ * Value of a field in a checked forecast.
+ */
+static inline int32_t forecast_value(const forecast_header_t *header, uint32_t row, int field)
+{
+    const int32_t *values =
+        (const int32_t *)((const uint8_t *)header + le16toh(header->header_size));
+
+    return (int32_t)le32toh(values[((size_t)row * le32toh(header->fields)) + field]);
+}
+
+
+#endif /* __FORECAST_H__ */
@@ -1,7 +1,7 @@
 #!/bin/bash
 
 echo "Read forecast"
-curl https://aladdin-service.herokuapp.com/forecast > /home/pi/rpi_ws281x/forecast
+curl -sf https://aladdin-service.herokuapp.com/forecast | /home/pi/rpi_ws281x/forecast_pack /home/pi/rpi_ws281x/forecast
 echo "Kill old instance..."
 pkill test
 echo "Run new instance..."
@@ -17,7 +17,7 @@ while true; do
     if [ $((C%60)) -eq 0 ]
     then
         echo "Update forecast... "
-        curl https://aladdin-service.herokuapp.com/forecast > /home/pi/rpi_ws281x/forecast
+        curl -sf https://aladdin-service.herokuapp.com/forecast | /home/pi/rpi_ws281x/forecast_pack /home/pi/rpi_ws281x/forecast
     fi
 
     # once per one hour
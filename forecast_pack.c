@@ -0,0 +1,209 @@
+/*
+ * forecast_pack.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Publish a forecast for the matrix demo.  Reads the forecast as the service sends it,
+ * rows of temperature, wind and precipitation as big endian 32 bit integers, from
+ * standard input and writes it in the format of forecast.h.  The file is written under
+ * a temporary name next to the target and renamed over it, so readers see either the
+ * old forecast or the new one.  Nothing is replaced unless the input is a whole
+ * number of rows.
+ *
+ *     curl -sf <url> | ./forecast_pack /home/pi/rpi_ws281x/forecast
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "forecast.h"
+
+
+#define FORECAST_PACK_ROW_BYTES                  (FORECAST_FIELDS * 4)
+#define FORECAST_PACK_MAX_ROWS                   4096
+
+
+/**
+ * Write all of a buffer.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len)
+    {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0)
+        {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * Read the service's rows from standard input.
+ *
+ * @param    values  Filled in with rows * FORECAST_FIELDS little endian values.
+ *
+ * @returns  Number of rows, -1 if the input is not a whole number of rows.
+ */
+static int read_rows(int32_t *values)
+{
+    static uint8_t input[(FORECAST_PACK_MAX_ROWS * FORECAST_PACK_ROW_BYTES) + 1];
+    size_t len = fread(input, 1, sizeof(input), stdin);
+    size_t i;
+
+    if (!len || (len % FORECAST_PACK_ROW_BYTES) || (len == sizeof(input)))
+    {
+        return -1;
+    }
+
+    for (i = 0; i < len / 4; i++)
+    {
+        uint32_t v = ((uint32_t)input[(i * 4)] << 24) | (input[(i * 4) + 1] << 16) |
+                     (input[(i * 4) + 2] << 8) | input[(i * 4) + 3];
+
+        values[i] = htole32(v);
+    }
+
+    return len / FORECAST_PACK_ROW_BYTES;
+}
+
+/**
+ * Write the forecast to a temporary file and rename it over the target.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int publish(const char *path, const int32_t *values, int rows)
+{
+    forecast_header_t header;
+    size_t size = rows * FORECAST_PACK_ROW_BYTES;
+    char *tmp = malloc(strlen(path) + 8);
+    int fd = -1;
+
+    if (!tmp)
+    {
+        return -1;
+    }
+    sprintf(tmp, "%s.XXXXXX", path);
+
+    memset(&header, 0, sizeof(header));
+    header.magic = htole32(FORECAST_MAGIC);
+    header.version = htole16(FORECAST_VERSION);
+    header.header_size = htole16(sizeof(header));
+    header.rows = htole32(rows);
+    header.fields = htole32(FORECAST_FIELDS);
+    header.timestamp = htole64(time(NULL));
+    header.checksum = htole32(forecast_checksum(values, size));
+
+    fd = mkstemp(tmp);
+    if (fd < 0)
+    {
+        goto err;
+    }
+
+    if (fchmod(fd, 0644) || write_all(fd, &header, sizeof(header)) ||
+        write_all(fd, values, size) || fsync(fd))
+    {
+        goto err_unlink;
+    }
+
+    if (close(fd))
+    {
+        fd = -1;
+        goto err_unlink;
+    }
+    fd = -1;
+
+    if (rename(tmp, path))
+    {
+        goto err_unlink;
+    }
+
+    free(tmp);
+
+    return 0;
+
+err_unlink:
+    perror(tmp);
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    unlink(tmp);
+    free(tmp);
+
+    return -1;
+
+err:
+    perror(tmp);
+    free(tmp);
+
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    static int32_t values[FORECAST_PACK_MAX_ROWS * FORECAST_FIELDS];
+    int rows;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <forecast file> < service output\n", argv[0]);
+        return -1;
+    }
+
+    rows = read_rows(values);
+    if (rows < 0)
+    {
+        fprintf(stderr, "forecast_pack: input is not a whole number of rows, %s left alone\n",
+                argv[1]);
+        return -1;
+    }
+
+    if (publish(argv[1], values, rows))
+    {
+        return -1;
+    }
+
+    return 0;
+}
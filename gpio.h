@@ -63,6 +63,7 @@ typedef struct
 
 
 #define GPIO                                     (0x20200000)  // 0x7e200000
+#define GPIO_PERIPH                              (0x7e200000)
 
 
 static inline void gpio_function_set(volatile gpio_t *gpio, uint8_t pin, uint8_t function)
@@ -0,0 +1,207 @@
+/*
+ * hw.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "dma.h"
+#include "backend.h"
+
+
+/*
+ * Real hardware backend.  Registers are mapped through /dev/mem and bus addresses come
+ * from the kernel pagemap, so this needs to run as root.
+ */
+
+
+#define PAGEMAP_PRESENT                          (1ULL << 63)
+
+
+typedef struct
+{
+    int pagemap_fd;
+} hw_t;
+
+
+/**
+ * Map a physical address and length into userspace virtual memory.
+ *
+ * @param    backend  Backend instance pointer.
+ * @param    phys     Physical 32-bit address of device registers.
+ * @param    len      Length of mapped region.
+ *
+ * @returns  Virtual address pointer to physical memory region, NULL on error.
+ */
+static void *hw_map_device(backend_t *backend, const uint32_t phys, const uint32_t len)
+{
+    uint32_t start_page_addr = phys & PAGE_MASK;
+    uint32_t end_page_addr = (phys + len) & PAGE_MASK;
+    uint32_t pages = end_page_addr - start_page_addr + 1;
+    int fd = open("/dev/mem", O_RDWR | O_SYNC);
+    void *virt;
+
+    if (fd < 0)
+    {
+        perror("Can't open /dev/mem");
+        close(fd);
+        return NULL;
+    }
+
+    virt = mmap(NULL, PAGE_SIZE * pages, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                start_page_addr);
+    if (virt == MAP_FAILED)
+    {
+        perror("map_device() mmap() failed");
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+
+    return (void *)(((uint8_t *)virt) + PAGE_OFFSET(phys));
+}
+
+/**
+ * Unmap a physical address and length from virtual memory.
+ *
+ * @param    backend  Backend instance pointer.
+ * @param    addr     Virtual address pointer of device registers.
+ * @param    len      Length of mapped region.
+ *
+ * @returns  None
+ */
+static void hw_unmap_device(backend_t *backend, volatile void *addr, const uint32_t len)
+{
+    uintptr_t virt = (uintptr_t)addr;
+    uintptr_t start_page_addr = virt & PAGE_MASK;
+    uintptr_t end_page_addr = (virt + len) & PAGE_MASK;
+    uint32_t pages = end_page_addr - start_page_addr + 1;
+
+    munmap((void *)start_page_addr, PAGE_SIZE * pages);
+}
+
+/**
+ * Given a run of userspace pages, return the matching bus addresses used by DMA.  The
+ * pagemap entries for the whole run are fetched with a single read.
+ *     Note: The bus address is not the same as the CPU physical address.
+ *
+ * @param    backend  Backend instance pointer.
+ * @param    addr     Page aligned userspace virtual address.
+ * @param    pages    Number of pages.
+ * @param    bus      Returns the bus address of each page.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int hw_pages_to_bus(backend_t *backend, const volatile void *addr, uint32_t pages,
+                           uint32_t *bus)
+{
+    hw_t *hw = backend->priv;
+    uintptr_t virt = (uintptr_t)addr;
+    off_t offset = (off_t)(virt >> 12) << 3;
+    size_t len = pages * sizeof(uint64_t);
+    uint64_t *entry = malloc(len);
+    uint32_t i;
+
+    if (!entry)
+    {
+        return -1;
+    }
+
+    if (pread(hw->pagemap_fd, entry, len, offset) != (ssize_t)len)
+    {
+        perror("pages_to_bus() pread() failed");
+        free(entry);
+        return -1;
+    }
+
+    for (i = 0; i < pages; i++)
+    {
+        if (!(entry[i] & PAGEMAP_PRESENT))
+        {
+            fprintf(stderr, "pages_to_bus() page not present\n");
+            free(entry);
+            return -1;
+        }
+
+        bus[i] = ((uint32_t)entry[i] << 12) | 0x40000000;
+    }
+
+    free(entry);
+
+    return 0;
+}
+
+static void hw_destroy(backend_t *backend)
+{
+    hw_t *hw = backend->priv;
+
+    close(hw->pagemap_fd);
+    free(hw);
+    free(backend);
+}
+
+backend_t *hw_backend_create(void)
+{
+    backend_t *backend = malloc(sizeof(*backend));
+    hw_t *hw = malloc(sizeof(*hw));
+
+    if (!backend || !hw)
+    {
+        goto err;
+    }
+
+    // Kept open, addresses are translated whenever DMA memory is allocated
+    hw->pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (hw->pagemap_fd < 0)
+    {
+        perror("Can't open pagemap");
+        goto err;
+    }
+
+    backend->map_device = hw_map_device;
+    backend->unmap_device = hw_unmap_device;
+    backend->pages_to_bus = hw_pages_to_bus;
+    backend->destroy = hw_destroy;
+    backend->priv = hw;
+
+    return backend;
+
+err:
+    free(hw);
+    free(backend);
+
+    return NULL;
+}
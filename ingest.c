@@ -0,0 +1,928 @@
+/*
+ * ingest.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Network pixel ingest.  Owns the hardware and fills the LEDs from E1.31 (sACN) data
+ * over UDP, received in batches with recvmmsg(), and from Open Pixel Control over TCP.
+ *
+ * E1.31 universes map onto the channels 170 RGB LEDs at a time: channel 0 starts at the
+ * first universe, channel 1 at the universe after the last one of channel 0.  A frame is
+ * rendered when a synchronization packet arrives for streams that use one, otherwise
+ * once every mapped universe has arrived, or when the timeout runs out after the first.
+ * Each OPC set pixels message is a frame of its own; OPC channel 0 covers both channels
+ * one after the other, 1 and 2 address them individually.
+ *
+ *     ./ingest [-s] [-d dma] [-g gpio] [-c count] [-G gpio] [-C count] [-u universe]
+ *              [-p port] [-o port] [-t ms] [-i seconds]
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "ws2811.h"
+
+
+#define ARRAY_SIZE(stuff)                        (sizeof(stuff) / sizeof(stuff[0]))
+
+#define INGEST_DMA                               5
+#define INGEST_GPIO0                             18
+#define INGEST_GPIO1                             13
+#define INGEST_COUNT0                            (18 * 14)
+#define INGEST_TIMEOUT_MS                        25           // Partial frame is rendered after
+#define INGEST_STATS_S                           10
+#define INGEST_BATCH                             64           // Datagrams per recvmmsg()
+#define INGEST_OPC_CLIENTS                       4
+
+#define E131_PORT                                5568
+#define E131_PACKET_MAX                          638
+#define E131_SYNC_LEN                            49
+#define E131_DATA_OFFSET                         126          // First DMX slot after the start code
+#define E131_LEDS_PER_UNIVERSE                   170          // 510 of the 512 slots
+#define E131_VECTOR_ROOT_DATA                    0x00000004
+#define E131_VECTOR_ROOT_EXTENDED                0x00000008
+#define E131_VECTOR_FRAME_DATA                   0x00000002
+#define E131_VECTOR_EXTENDED_SYNC                0x00000001
+#define E131_VECTOR_DMP_SET_PROPERTY             0x02
+#define E131_OPTION_PREVIEW                      (1 << 7)
+#define E131_OPTION_TERMINATED                   (1 << 6)
+#define E131_SEQ_WINDOW                          20           // Older than this is a restart
+
+#define OPC_PORT                                 7890
+#define OPC_HEADER_LEN                           4
+#define OPC_MAX_LEN                              (OPC_HEADER_LEN + 0xffff)
+#define OPC_SET_PIXELS                           0
+
+
+typedef struct
+{
+    int chan;                                    // Channel the universe lands on
+    int first;                                   // First LED
+    int count;                                   // LEDs it carries
+    int seen;                                    // Arrived since the last frame
+    int seq_valid;
+    uint8_t seq;                                 // Last sequence number
+} ingest_universe_t;
+
+typedef struct
+{
+    int fd;                                      // -1 if unused
+    uint32_t len;                                // Bytes in buf
+    uint8_t buf[OPC_MAX_LEN];
+} ingest_opc_t;
+
+typedef struct
+{
+    uint64_t packets;                            // E1.31 data packets for mapped universes
+    uint64_t lost;                               // Gaps in the sequence numbers
+    uint64_t out_of_order;                       // Late or duplicate packets, dropped
+    uint64_t ignored;                            // Malformed, preview or unmapped packets
+    uint64_t batches;                            // recvmmsg() calls that returned packets
+    uint64_t frames_complete;                    // Every universe arrived
+    uint64_t frames_sync;                        // Released by a sync packet
+    uint64_t frames_timeout;                     // Released by the timeout, partial
+    uint64_t frames_opc;                         // OPC set pixels messages
+    uint64_t latency_total_ns;                   // First packet of a frame until rendered
+    uint64_t latency_max_ns;
+    uint64_t latency_count;
+} ingest_stats_t;
+
+typedef struct
+{
+    ws2811_t ws2811;
+    int epfd;
+    int udp_fd;
+    int listen_fd;
+    int timer_fd;
+    int signal_fd;
+    int dma_fd;
+    uint16_t universe_first;
+    int universe_count;
+    ingest_universe_t *universe;
+    ws2811_led_t *stage[RPI_PWM_CHANNELS];       // Frame being received, copied out on release
+    int seen;                                    // Universes seen this frame
+    uint16_t sync_address;                       // Sync universe of the stream, 0 for none
+    uint64_t frame_start_ns;                     // First packet of the frame, 0 if none yet
+    int frame_ready;                             // Waiting for the DMA to render
+    int dma_busy;
+    int timeout_ms;
+    ingest_opc_t opc[INGEST_OPC_CLIENTS];
+    ingest_stats_t stats;
+    uint8_t packet[INGEST_BATCH][E131_PACKET_MAX];
+} ingest_t;
+
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static uint16_t get_be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int epoll_add(int epfd, int fd)
+{
+    struct epoll_event ev =
+    {
+        .events = EPOLLIN,
+        .data.fd = fd,
+    };
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/**
+ * Copy RGB triplets into the staged frame of a channel, clipped to its length.
+ *
+ * @param    ingest  Ingest state.
+ * @param    chan    Channel number.
+ * @param    first   First LED to write.
+ * @param    rgb     RGB bytes.
+ * @param    leds    Number of triplets.
+ *
+ * @returns  None
+ */
+static void leds_from_rgb(ingest_t *ingest, int chan, int first, const uint8_t *rgb, int leds)
+{
+    ws2811_led_t *stage = ingest->stage[chan];
+    int count = ingest->ws2811.channel[chan].count;
+    int i;
+
+    if (first + leds > count)
+    {
+        leds = count - first;
+    }
+
+    for (i = 0; i < leds; i++)
+    {
+        stage[first + i] = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+        rgb += 3;
+    }
+}
+
+/**
+ * Build the universe map, channel 0 first.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int universe_map(ingest_t *ingest)
+{
+    ws2811_t *ws2811 = &ingest->ws2811;
+    int chan, i, u = 0;
+
+    ingest->universe_count = 0;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ingest->universe_count += (ws2811->channel[chan].count + E131_LEDS_PER_UNIVERSE - 1) /
+                                  E131_LEDS_PER_UNIVERSE;
+    }
+
+    if (ingest->universe_first + ingest->universe_count > 64000)
+    {
+        return -1;
+    }
+
+    ingest->universe = calloc(ingest->universe_count + 1, sizeof(*ingest->universe));
+    if (!ingest->universe)
+    {
+        return -1;
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ingest->stage[chan] = calloc(ws2811->channel[chan].count + 1, sizeof(ws2811_led_t));
+        if (!ingest->stage[chan])
+        {
+            return -1;
+        }
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        for (i = 0; i < ws2811->channel[chan].count; i += E131_LEDS_PER_UNIVERSE)
+        {
+            ingest->universe[u].chan = chan;
+            ingest->universe[u].first = i;
+            ingest->universe[u].count = ws2811->channel[chan].count - i;
+            if (ingest->universe[u].count > E131_LEDS_PER_UNIVERSE)
+            {
+                ingest->universe[u].count = E131_LEDS_PER_UNIVERSE;
+            }
+            u++;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Hand the staged frame to the LEDs, to render now or once the DMA is idle.  A frame
+ * still waiting for the DMA is replaced as a whole, never mixed with the next one.
+ *
+ * @returns  None
+ */
+static void frame_publish(ingest_t *ingest)
+{
+    ws2811_t *ws2811 = &ingest->ws2811;
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        memcpy(ws2811->channel[chan].leds, ingest->stage[chan],
+               ws2811->channel[chan].count * sizeof(ws2811_led_t));
+    }
+
+    ingest->frame_ready = 1;
+}
+
+/**
+ * Finish the E1.31 frame being received.
+ *
+ * @returns  None
+ */
+static void frame_release(ingest_t *ingest, uint64_t *counter)
+{
+    struct itimerspec off;
+    int i;
+
+    (*counter)++;
+    frame_publish(ingest);
+
+    for (i = 0; i < ingest->universe_count; i++)
+    {
+        ingest->universe[i].seen = 0;
+    }
+    ingest->seen = 0;
+
+    memset(&off, 0, sizeof(off));
+    timerfd_settime(ingest->timer_fd, 0, &off, NULL);
+}
+
+/**
+ * Render a released frame if the previous one has gone out.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int frame_render(ingest_t *ingest)
+{
+    ingest_stats_t *stats = &ingest->stats;
+
+    if (!ingest->frame_ready || ingest->dma_busy)
+    {
+        return 0;
+    }
+
+    if (ws2811_render(&ingest->ws2811))
+    {
+        return -1;
+    }
+
+    // Nothing is sent, and no completion comes, when no LED changed
+    ingest->dma_busy = ingest->ws2811.encoded > 0;
+    ingest->frame_ready = 0;
+
+    if (ingest->frame_start_ns)
+    {
+        uint64_t latency = monotonic_ns() - ingest->frame_start_ns;
+
+        stats->latency_total_ns += latency;
+        stats->latency_count++;
+        if (latency > stats->latency_max_ns)
+        {
+            stats->latency_max_ns = latency;
+        }
+        ingest->frame_start_ns = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Handle one E1.31 packet.
+ *
+ * @param    ingest  Ingest state.
+ * @param    p       Packet.
+ * @param    len     Packet length.
+ * @param    now     Receive time.
+ *
+ * @returns  None
+ */
+static void e131_packet(ingest_t *ingest, const uint8_t *p, int len, uint64_t now)
+{
+    static const uint8_t acn_id[12] = "ASC-E1.17\0\0";
+    ingest_stats_t *stats = &ingest->stats;
+    ingest_universe_t *universe;
+    uint32_t root_vector;
+    uint16_t number, slots;
+    uint8_t seq, options;
+    int8_t diff;
+
+    if ((len < E131_SYNC_LEN) || (get_be16(&p[0]) != 0x0010) || memcmp(&p[4], acn_id, 12))
+    {
+        stats->ignored++;
+        return;
+    }
+
+    root_vector = get_be32(&p[18]);
+    if ((root_vector == E131_VECTOR_ROOT_EXTENDED) &&
+        (get_be32(&p[40]) == E131_VECTOR_EXTENDED_SYNC))
+    {
+        if (ingest->sync_address && (get_be16(&p[45]) == ingest->sync_address) &&
+            ingest->frame_start_ns)
+        {
+            frame_release(ingest, &stats->frames_sync);
+        }
+        return;
+    }
+
+    if ((root_vector != E131_VECTOR_ROOT_DATA) || (len < E131_DATA_OFFSET) ||
+        (get_be32(&p[40]) != E131_VECTOR_FRAME_DATA) ||
+        (p[117] != E131_VECTOR_DMP_SET_PROPERTY) || (p[125] != 0))
+    {
+        stats->ignored++;
+        return;
+    }
+
+    options = p[112];
+    number = get_be16(&p[113]);
+    if ((options & (E131_OPTION_PREVIEW | E131_OPTION_TERMINATED)) ||
+        (number < ingest->universe_first) ||
+        (number >= ingest->universe_first + ingest->universe_count))
+    {
+        stats->ignored++;
+        return;
+    }
+
+    universe = &ingest->universe[number - ingest->universe_first];
+    seq = p[111];
+    if (universe->seq_valid)
+    {
+        diff = (int8_t)(seq - universe->seq);
+        if ((diff <= 0) && (diff > -E131_SEQ_WINDOW))
+        {
+            stats->out_of_order++;
+            return;
+        }
+        if (diff > 1)
+        {
+            stats->lost += diff - 1;
+        }
+    }
+    universe->seq = seq;
+    universe->seq_valid = 1;
+    stats->packets++;
+
+    slots = get_be16(&p[123]) - 1;
+    if (slots > len - E131_DATA_OFFSET)
+    {
+        slots = len - E131_DATA_OFFSET;
+    }
+    if (slots / 3 < universe->count)
+    {
+        leds_from_rgb(ingest, universe->chan, universe->first,
+                      &p[E131_DATA_OFFSET], slots / 3);
+    }
+    else
+    {
+        leds_from_rgb(ingest, universe->chan, universe->first,
+                      &p[E131_DATA_OFFSET], universe->count);
+    }
+
+    ingest->sync_address = get_be16(&p[109]);
+
+    // First universe of a frame starts the timeout
+    if (!ingest->frame_start_ns)
+    {
+        struct itimerspec its;
+
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec = ingest->timeout_ms / 1000;
+        its.it_value.tv_nsec = (ingest->timeout_ms % 1000) * 1000000;
+        timerfd_settime(ingest->timer_fd, 0, &its, NULL);
+        ingest->frame_start_ns = now;
+    }
+
+    if (!universe->seen)
+    {
+        universe->seen = 1;
+        ingest->seen++;
+    }
+
+    if (!ingest->sync_address && (ingest->seen == ingest->universe_count))
+    {
+        frame_release(ingest, &stats->frames_complete);
+    }
+}
+
+/**
+ * Drain the UDP socket, a batch of datagrams per system call.
+ *
+ * @returns  None
+ */
+static void e131_receive(ingest_t *ingest)
+{
+    struct mmsghdr msgs[INGEST_BATCH];
+    struct iovec iov[INGEST_BATCH];
+    int i, n;
+
+    for (i = 0; i < INGEST_BATCH; i++)
+    {
+        iov[i].iov_base = ingest->packet[i];
+        iov[i].iov_len = E131_PACKET_MAX;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while ((n = recvmmsg(ingest->udp_fd, msgs, INGEST_BATCH, MSG_DONTWAIT, NULL)) > 0)
+    {
+        uint64_t now = monotonic_ns();
+
+        ingest->stats.batches++;
+        for (i = 0; i < n; i++)
+        {
+            e131_packet(ingest, ingest->packet[i], msgs[i].msg_len, now);
+        }
+
+        if (n < INGEST_BATCH)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * Handle the complete OPC messages buffered for a client.
+ *
+ * @returns  None
+ */
+static void opc_messages(ingest_t *ingest, ingest_opc_t *client)
+{
+    ws2811_t *ws2811 = &ingest->ws2811;
+    uint32_t done = 0;
+
+    while (client->len - done >= OPC_HEADER_LEN)
+    {
+        const uint8_t *msg = &client->buf[done];
+        uint32_t len = get_be16(&msg[2]);
+        const uint8_t *rgb = &msg[OPC_HEADER_LEN];
+        int leds = len / 3;
+
+        if (client->len - done < OPC_HEADER_LEN + len)
+        {
+            break;
+        }
+        done += OPC_HEADER_LEN + len;
+
+        if (msg[1] != OPC_SET_PIXELS)
+        {
+            continue;
+        }
+
+        if (msg[0] == 0)
+        {
+            int first = leds < ws2811->channel[0].count ? leds : ws2811->channel[0].count;
+
+            leds_from_rgb(ingest, 0, 0, rgb, first);
+            leds_from_rgb(ingest, 1, 0, rgb + (first * 3), leds - first);
+        }
+        else if (msg[0] <= RPI_PWM_CHANNELS)
+        {
+            leds_from_rgb(ingest, msg[0] - 1, 0, rgb, leds);
+        }
+
+        if (!ingest->frame_start_ns)
+        {
+            ingest->frame_start_ns = monotonic_ns();
+        }
+        frame_publish(ingest);
+        ingest->stats.frames_opc++;
+    }
+
+    memmove(client->buf, &client->buf[done], client->len - done);
+    client->len -= done;
+}
+
+/**
+ * Read from an OPC client, closing it on end of stream.
+ *
+ * @returns  None
+ */
+static void opc_receive(ingest_t *ingest, ingest_opc_t *client)
+{
+    ssize_t n = read(client->fd, &client->buf[client->len], OPC_MAX_LEN - client->len);
+
+    if (n <= 0)
+    {
+        if ((n < 0) && (errno == EAGAIN))
+        {
+            return;
+        }
+
+        epoll_ctl(ingest->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+        close(client->fd);
+        client->fd = -1;
+        return;
+    }
+
+    client->len += n;
+    opc_messages(ingest, client);
+}
+
+static void opc_accept(ingest_t *ingest)
+{
+    int fd = accept4(ingest->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    size_t i;
+
+    if (fd < 0)
+    {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(ingest->opc); i++)
+    {
+        if ((ingest->opc[i].fd < 0) && !epoll_add(ingest->epfd, fd))
+        {
+            ingest->opc[i].fd = fd;
+            ingest->opc[i].len = 0;
+            return;
+        }
+    }
+
+    close(fd);
+}
+
+static void stats_print(ingest_t *ingest, double seconds)
+{
+    ingest_stats_t *stats = &ingest->stats;
+    ws2811_stats_t lib;
+
+    ws2811_get_stats(&ingest->ws2811, &lib);
+
+    fprintf(stderr, "ingest: %.0f universes/s in %.1f per batch, lost %llu out of order %llu "
+            "ignored %llu, frames complete %llu sync %llu timeout %llu opc %llu, "
+            "rendered %llu in total, latency mean %lluus max %lluus\n",
+            stats->packets / seconds,
+            stats->batches ? (double)stats->packets / stats->batches : 0.0,
+            (unsigned long long)stats->lost, (unsigned long long)stats->out_of_order,
+            (unsigned long long)stats->ignored,
+            (unsigned long long)stats->frames_complete, (unsigned long long)stats->frames_sync,
+            (unsigned long long)stats->frames_timeout, (unsigned long long)stats->frames_opc,
+            (unsigned long long)lib.frames_rendered,
+            (unsigned long long)(stats->latency_count ?
+                                 stats->latency_total_ns / stats->latency_count / 1000 : 0),
+            (unsigned long long)stats->latency_max_ns / 1000);
+
+    // Counts are per interval, the loss and frame totals are too
+    memset(stats, 0, sizeof(*stats));
+}
+
+/**
+ * Open the sockets and join the multicast group of every mapped universe.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int sockets_open(ingest_t *ingest, int e131_port, int opc_port)
+{
+    struct sockaddr_in addr;
+    int one = 1, rcvbuf = 4 * 1024 * 1024;
+    int i;
+
+    ingest->udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ingest->udp_fd < 0)
+    {
+        return -1;
+    }
+
+    setsockopt(ingest->udp_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(ingest->udp_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(e131_port);
+    if (bind(ingest->udp_fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        return -1;
+    }
+
+    // 239.255.<universe high>.<universe low>, without a multicast route only unicast works
+    for (i = 0; i < ingest->universe_count; i++)
+    {
+        uint16_t number = ingest->universe_first + i;
+        struct ip_mreq mreq =
+        {
+            .imr_multiaddr.s_addr = htonl(0xefff0000 | number),
+            .imr_interface.s_addr = htonl(INADDR_ANY),
+        };
+
+        setsockopt(ingest->udp_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+
+    if (!opc_port)
+    {
+        return 0;
+    }
+
+    ingest->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ingest->listen_fd < 0)
+    {
+        return -1;
+    }
+
+    setsockopt(ingest->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_port = htons(opc_port);
+    if (bind(ingest->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(ingest->listen_fd, INGEST_OPC_CLIENTS))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Event loop, until SIGINT or SIGTERM.
+ *
+ * @returns  0 on a clean stop, -1 on error.
+ */
+static int ingest_run(ingest_t *ingest, int stats_interval)
+{
+    struct epoll_event events[8];
+    uint64_t stats_start = monotonic_ns();
+    uint64_t stats_ns = stats_interval * 1000000000ULL;
+    int i, n;
+
+    for (;;)
+    {
+        int timeout = -1;
+
+        // Wake up for the stats even while packets keep coming in
+        if (stats_interval)
+        {
+            uint64_t elapsed = monotonic_ns() - stats_start;
+
+            timeout = elapsed < stats_ns ? ((stats_ns - elapsed) + 999999) / 1000000 : 0;
+        }
+
+        n = epoll_wait(ingest->epfd, events, ARRAY_SIZE(events), timeout);
+        if ((n < 0) && (errno != EINTR))
+        {
+            return -1;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            size_t c;
+
+            if (fd == ingest->udp_fd)
+            {
+                e131_receive(ingest);
+            }
+            else if (fd == ingest->signal_fd)
+            {
+                return 0;
+            }
+            else if (fd == ingest->timer_fd)
+            {
+                uint64_t expirations;
+
+                if ((read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) &&
+                    ingest->frame_start_ns && !ingest->frame_ready)
+                {
+                    frame_release(ingest, &ingest->stats.frames_timeout);
+                }
+            }
+            else if (fd == ingest->dma_fd)
+            {
+                int status = ws2811_try_wait(&ingest->ws2811);
+
+                if (status < 0)
+                {
+                    return -1;
+                }
+                ingest->dma_busy = status > 0;
+            }
+            else if (fd == ingest->listen_fd)
+            {
+                opc_accept(ingest);
+            }
+            else
+            {
+                for (c = 0; c < ARRAY_SIZE(ingest->opc); c++)
+                {
+                    if (ingest->opc[c].fd == fd)
+                    {
+                        opc_receive(ingest, &ingest->opc[c]);
+                    }
+                }
+            }
+        }
+
+        if (frame_render(ingest))
+        {
+            return -1;
+        }
+
+        if (stats_interval && (monotonic_ns() - stats_start >= stats_ns))
+        {
+            uint64_t now = monotonic_ns();
+
+            stats_print(ingest, (now - stats_start) / 1e9);
+            stats_start = now;
+        }
+    }
+}
+
+static void ingest_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-s] [-d dma] [-g gpio] [-c count] [-G gpio] [-C count]\n"
+            "       [-u universe] [-p port] [-o port] [-t ms] [-i seconds]\n"
+            "  -s  use the simulator backend\n"
+            "  -d  DMA channel, default %d\n"
+            "  -g  -c  GPIO and LED count of channel 0, default %d and %d\n"
+            "  -G  -C  GPIO and LED count of channel 1, default %d and 0\n"
+            "  -u  E1.31 universe of the first LED, default 1\n"
+            "  -p  E1.31 UDP port, default %d\n"
+            "  -o  OPC TCP port, 0 for none, default %d\n"
+            "  -t  render a partial frame this long after its first universe, default %d\n"
+            "  -i  seconds between stats on stderr, 0 for none, default %d\n",
+            prog, INGEST_DMA, INGEST_GPIO0, INGEST_COUNT0, INGEST_GPIO1, E131_PORT, OPC_PORT,
+            INGEST_TIMEOUT_MS, INGEST_STATS_S);
+}
+
+int main(int argc, char *argv[])
+{
+    static ingest_t ingest;
+    ws2811_t *ws2811 = &ingest.ws2811;
+    int e131_port = E131_PORT, opc_port = OPC_PORT, stats_interval = INGEST_STATS_S;
+    sigset_t mask;
+    size_t c;
+    int ret = -1, chan, opt;
+
+    ws2811->freq = WS2811_TARGET_FREQ;
+    ws2811->dmanum = INGEST_DMA;
+    ws2811->channel[0].gpionum = INGEST_GPIO0;
+    ws2811->channel[0].count = INGEST_COUNT0;
+    ws2811->channel[1].gpionum = INGEST_GPIO1;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811->channel[chan].brightness = 255;
+    }
+    ingest.universe_first = 1;
+    ingest.timeout_ms = INGEST_TIMEOUT_MS;
+    ingest.epfd = ingest.udp_fd = ingest.listen_fd = ingest.timer_fd = ingest.signal_fd = -1;
+    for (c = 0; c < ARRAY_SIZE(ingest.opc); c++)
+    {
+        ingest.opc[c].fd = -1;
+    }
+
+    while ((opt = getopt(argc, argv, "sd:g:c:G:C:u:p:o:t:i:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': ws2811->backend = WS2811_BACKEND_SIM; break;
+            case 'd': ws2811->dmanum = atoi(optarg); break;
+            case 'g': ws2811->channel[0].gpionum = atoi(optarg); break;
+            case 'c': ws2811->channel[0].count = atoi(optarg); break;
+            case 'G': ws2811->channel[1].gpionum = atoi(optarg); break;
+            case 'C': ws2811->channel[1].count = atoi(optarg); break;
+            case 'u': ingest.universe_first = atoi(optarg); break;
+            case 'p': e131_port = atoi(optarg); break;
+            case 'o': opc_port = atoi(optarg); break;
+            case 't': ingest.timeout_ms = atoi(optarg); break;
+            case 'i': stats_interval = atoi(optarg); break;
+            default:
+                ingest_usage(argv[0]);
+                return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    // Blocked before any library thread starts, read from the signalfd instead
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) || (ingest.timeout_ms < 1) ||
+        (ingest.universe_first < 1) || universe_map(&ingest))
+    {
+        ingest_usage(argv[0]);
+        return -1;
+    }
+
+    if (ws2811_init(ws2811))
+    {
+        fprintf(stderr, "ingest: ws2811_init failed\n");
+        return -1;
+    }
+
+    ingest.dma_fd = ws2811_get_fd(ws2811);
+    ingest.epfd = epoll_create1(EPOLL_CLOEXEC);
+    ingest.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ingest.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if ((ingest.epfd < 0) || (ingest.timer_fd < 0) || (ingest.signal_fd < 0) ||
+        sockets_open(&ingest, e131_port, opc_port) ||
+        epoll_add(ingest.epfd, ingest.udp_fd) || epoll_add(ingest.epfd, ingest.timer_fd) ||
+        epoll_add(ingest.epfd, ingest.signal_fd) || epoll_add(ingest.epfd, ingest.dma_fd) ||
+        ((ingest.listen_fd >= 0) && epoll_add(ingest.epfd, ingest.listen_fd)))
+    {
+        perror("ingest");
+        goto out;
+    }
+
+    fprintf(stderr, "ingest: universes %u to %u on port %d, OPC on port %d\n",
+            ingest.universe_first, ingest.universe_first + ingest.universe_count - 1,
+            e131_port, opc_port);
+
+    ret = ingest_run(&ingest, stats_interval);
+
+out:
+    for (c = 0; c < ARRAY_SIZE(ingest.opc); c++)
+    {
+        if (ingest.opc[c].fd >= 0)
+        {
+            close(ingest.opc[c].fd);
+        }
+    }
+    if (ingest.listen_fd >= 0)
+    {
+        close(ingest.listen_fd);
+    }
+    if (ingest.udp_fd >= 0)
+    {
+        close(ingest.udp_fd);
+    }
+    if (ingest.signal_fd >= 0)
+    {
+        close(ingest.signal_fd);
+    }
+    if (ingest.timer_fd >= 0)
+    {
+        close(ingest.timer_fd);
+    }
+    if (ingest.epfd >= 0)
+    {
+        close(ingest.epfd);
+    }
+
+    ws2811_fini(ws2811);
+    free(ingest.universe);
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        free(ingest.stage[chan]);
+    }
+
+    return ret;
+}
@@ -0,0 +1,379 @@
+/*
+ * layout.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2811.h"
+
+#include "layout.h"
+
+
+#define LAYOUT_LINE_MAX                          256
+
+
+/**
+ * Append the pixel of the next LED, extending the last run when it moves by the same
+ * step.
+ *
+ * @returns  0 on success, -1 if out of memory.
+ */
+static int layout_append(layout_t *layout, uint32_t *runs_max, uint32_t src)
+{
+    layout_run_t *run = layout->run_count ? &layout->runs[layout->run_count - 1] : NULL;
+
+    if (run)
+    {
+        int32_t step = (int32_t)(src - run->src);
+
+        if (run->count == 1)
+        {
+            run->step = step;
+            run->count++;
+            goto out;
+        }
+        if (src == run->src + (run->step * (int32_t)run->count))
+        {
+            run->count++;
+            goto out;
+        }
+    }
+
+    if (layout->run_count == *runs_max)
+    {
+        layout_run_t *runs;
+
+        *runs_max = *runs_max ? *runs_max * 2 : 16;
+        runs = realloc(layout->runs, *runs_max * sizeof(*runs));
+        if (!runs)
+        {
+            return -1;
+        }
+        layout->runs = runs;
+    }
+
+    run = &layout->runs[layout->run_count++];
+    run->src = src;
+    run->step = 1;
+    run->dst = layout->led_count;
+    run->count = 1;
+
+out:
+    layout->led_count++;
+
+    return 0;
+}
+
+/**
+ * Turn a geometry into copy runs in LED order.
+ *
+ * @param    geometry  Matrix geometry.
+ * @param    layout    Filled in, release with layout_free().
+ *
+ * @returns  0 on success, -1 for an invalid geometry or out of memory.
+ */
+int layout_compile(const layout_geometry_t *geometry, layout_t *layout)
+{
+    int width = geometry->width, height = geometry->height;
+    int tile_width = geometry->tile_width ? geometry->tile_width : width;
+    int tile_height = geometry->tile_height ? geometry->tile_height : height;
+    int rotated = (geometry->rotate == 90) || (geometry->rotate == 270);
+    int wire_width = rotated ? tile_height : tile_width;
+    int tiles_x, tiles_y, tx, ty, n, i;
+    uint32_t runs_max = 0;
+    uint8_t *skip = NULL;
+
+    memset(layout, 0, sizeof(*layout));
+
+    if ((width < 1) || (height < 1) || ((uint64_t)width * height > LAYOUT_MAX_PIXELS) ||
+        (tile_width < 1) || (tile_height < 1) ||
+        (width % tile_width) || (height % tile_height) || (geometry->rotate % 90) ||
+        (geometry->rotate < 0) || (geometry->rotate > 270))
+    {
+        return -1;
+    }
+
+    skip = calloc(width * height, 1);
+    if (!skip)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < geometry->skip_count; i++)
+    {
+        if (geometry->skip[i] >= (uint32_t)(width * height))
+        {
+            goto err;
+        }
+        skip[geometry->skip[i]] = 1;
+    }
+
+    layout->width = width;
+    layout->height = height;
+    tiles_x = width / tile_width;
+    tiles_y = height / tile_height;
+
+    for (ty = 0; ty < tiles_y; ty++)
+    {
+        for (tx = 0; tx < tiles_x; tx++)
+        {
+            int tile_x = (geometry->tile_serpentine && (ty & 1)) ? tiles_x - 1 - tx : tx;
+
+            for (n = 0; n < tile_width * tile_height; n++)
+            {
+                int u = n % wire_width, v = n / wire_width;
+                int x, y;
+                uint32_t src;
+
+                if (geometry->serpentine && (v & 1))
+                {
+                    u = wire_width - 1 - u;
+                }
+
+                switch (geometry->rotate)
+                {
+                    case 90:  x = tile_width - 1 - v; y = u; break;
+                    case 180: x = tile_width - 1 - u; y = tile_height - 1 - v; break;
+                    case 270: x = v; y = tile_height - 1 - u; break;
+                    default:  x = u; y = v; break;
+                }
+
+                src = ((ty * tile_height) + y) * width + (tile_x * tile_width) + x;
+                if (skip[src])
+                {
+                    continue;
+                }
+
+                if (layout_append(layout, &runs_max, src))
+                {
+                    goto err;
+                }
+            }
+        }
+    }
+
+    free(skip);
+
+    return 0;
+
+err:
+    free(skip);
+    layout_free(layout);
+
+    return -1;
+}
+
+/**
+ * Read a geometry description and compile it.  One setting per line, '#' starts a
+ * comment:
+ *
+ *     size <width> <height>
+ *     tile <width> <height>
+ *     serpentine
+ *     tile_serpentine
+ *     rotate <0|90|180|270>
+ *     skip <x> <y>
+ *
+ * @param    path    Description file.
+ * @param    layout  Filled in, release with layout_free().
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int layout_load(const char *path, layout_t *layout)
+{
+    layout_geometry_t geometry;
+    char line[LAYOUT_LINE_MAX];
+    uint32_t *skip = NULL;
+    struct { int x, y; } *skips = NULL;
+    int skips_max = 0, lineno = 0, ret = -1, i;
+    FILE *fp;
+
+    memset(&geometry, 0, sizeof(geometry));
+    memset(layout, 0, sizeof(*layout));
+
+    fp = fopen(path, "r");
+    if (!fp)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        char word[32];
+        int a, b, n;
+        char *comment = strchr(line, '#');
+
+        lineno++;
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        n = sscanf(line, "%31s %d %d", word, &a, &b);
+        if (n < 1)
+        {
+            continue;
+        }
+
+        if (!strcmp(word, "size") && (n == 3))
+        {
+            geometry.width = a;
+            geometry.height = b;
+        }
+        else if (!strcmp(word, "tile") && (n == 3))
+        {
+            geometry.tile_width = a;
+            geometry.tile_height = b;
+        }
+        else if (!strcmp(word, "serpentine") && (n == 1))
+        {
+            geometry.serpentine = 1;
+        }
+        else if (!strcmp(word, "tile_serpentine") && (n == 1))
+        {
+            geometry.tile_serpentine = 1;
+        }
+        else if (!strcmp(word, "rotate") && (n == 2))
+        {
+            geometry.rotate = a;
+        }
+        else if (!strcmp(word, "skip") && (n == 3) && (a >= 0) && (b >= 0))
+        {
+            if (geometry.skip_count == skips_max)
+            {
+                void *grown;
+
+                skips_max = skips_max ? skips_max * 2 : 16;
+                grown = realloc(skips, skips_max * sizeof(*skips));
+                if (!grown)
+                {
+                    goto out;
+                }
+                skips = grown;
+                grown = realloc(skip, skips_max * sizeof(*skip));
+                if (!grown)
+                {
+                    goto out;
+                }
+                skip = grown;
+            }
+            skips[geometry.skip_count].x = a;
+            skips[geometry.skip_count].y = b;
+            geometry.skip_count++;
+        }
+        else
+        {
+            fprintf(stderr, "layout: %s:%d: cannot parse '%s'\n", path, lineno, word);
+            goto out;
+        }
+    }
+
+    // Positions are only known to be inside the matrix once its size is
+    for (i = 0; i < geometry.skip_count; i++)
+    {
+        if ((skips[i].x >= geometry.width) || (skips[i].y >= geometry.height))
+        {
+            fprintf(stderr, "layout: %s: skip %d %d is outside the matrix\n", path,
+                    skips[i].x, skips[i].y);
+            goto out;
+        }
+    }
+
+    for (i = 0; i < geometry.skip_count; i++)
+    {
+        skip[i] = (skips[i].y * geometry.width) + skips[i].x;
+    }
+    geometry.skip = skip;
+
+    ret = layout_compile(&geometry, layout);
+    if (ret)
+    {
+        fprintf(stderr, "layout: %s: invalid geometry\n", path);
+    }
+
+out:
+    free(skip);
+    free(skips);
+    fclose(fp);
+
+    return ret;
+}
+
+/**
+ * Release a compiled layout.
+ *
+ * @param    layout  Layout from layout_compile() or layout_load().
+ *
+ * @returns  None
+ */
+void layout_free(layout_t *layout)
+{
+    free(layout->runs);
+    memset(layout, 0, sizeof(*layout));
+}
+
+/**
+ * Copy a row-major framebuffer of ws2811_led_t onto the LEDs.  Runs of pixels already
+ * in LED order are a memcpy().
+ *
+ * @param    layout  Compiled layout.
+ * @param    pixels  layout->width * layout->height pixels.
+ * @param    leds    layout->led_count LEDs.
+ *
+ * @returns  None
+ */
+void layout_apply(const layout_t *layout, const ws2811_led_t *pixels, ws2811_led_t *leds)
+{
+    uint32_t r, i;
+
+    for (r = 0; r < layout->run_count; r++)
+    {
+        const layout_run_t *run = &layout->runs[r];
+        const ws2811_led_t *src = &pixels[run->src];
+        ws2811_led_t *dst = &leds[run->dst];
+
+        if (run->step == 1)
+        {
+            memcpy(dst, src, run->count * sizeof(*dst));
+            continue;
+        }
+
+        for (i = 0; i < run->count; i++)
+        {
+            dst[i] = *src;
+            src += run->step;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * layout.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+
+#ifndef __LAYOUT_H__
+#define __LAYOUT_H__
+
+
+#define LAYOUT_MAX_PIXELS                        (1 << 20)
+
+
+/*
+ * Geometry of a matrix.  The pixels are cut into tiles of tile_width by tile_height that
+ * are chained row after row.  Inside a tile the LEDs run along rows of the tile's own
+ * wiring, which is turned clockwise by rotate degrees.  Skipped pixels have no LED, the
+ * chain carries on with the next pixel.
+ */
+typedef struct
+{
+    int width;                                   //< Framebuffer width in pixels
+    int height;                                  //< Framebuffer height in pixels
+    int tile_width;                              //< 0 for one tile of the whole matrix
+    int tile_height;
+    int serpentine;                              //< Every other row inside a tile reversed
+    int tile_serpentine;                         //< Every other row of tiles reversed
+    int rotate;                                  //< 0, 90, 180 or 270
+    const uint32_t *skip;                        //< Framebuffer indices without an LED
+    int skip_count;
+} layout_geometry_t;
+
+/*
+ * Copy of count pixels to consecutive LEDs, starting at framebuffer index src and
+ * moving step pixels for every LED.  step is 1 for pixels that are already in order.
+ */
+typedef struct
+{
+    uint32_t src;
+    int32_t step;
+    uint32_t dst;
+    uint32_t count;
+} layout_run_t;
+
+/*
+ * Compiled layout, framebuffer index y * width + x to LED index.
+ */
+typedef struct
+{
+    int width;
+    int height;
+    uint32_t led_count;                          //< LEDs on the chain
+    uint32_t run_count;
+    layout_run_t *runs;
+} layout_t;
+
+
+int layout_compile(const layout_geometry_t *geometry, layout_t *layout);
+int layout_load(const char *path, layout_t *layout);
+void layout_free(layout_t *layout);
+void layout_apply(const layout_t *layout, const ws2811_led_t *pixels, ws2811_led_t *leds);
+
+
+#endif /* __LAYOUT_H__ */
@@ -0,0 +1,289 @@
+/*
+ * ledd.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * LED daemon.  Owns the hardware and shares the LED buffers of both channels with
+ * other processes through a /dev/shm segment laid out as in ledshm.h.  Clients write
+ * pixels in place and bump the commit counter; every commit seen is rendered, with
+ * commits that arrive while a frame is in flight merged into the next one.
+ *
+ *     ./ledd [-n name] [-f] [-d dma] [-g gpio] [-c count] [-G gpio] [-C count] [-s]
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ws2811.h"
+#include "ledshm.h"
+
+
+#define LEDD_DMA                                 5
+#define LEDD_GPIO0                               18
+#define LEDD_GPIO1                               13
+#define LEDD_COUNT0                              (18 * 14)
+#define LEDD_WAIT_MS                             1000         // Recheck for shutdown
+#define LEDD_ALIGN                               64           // Channel arrays start on a cache line
+
+
+static volatile sig_atomic_t ledd_stop;
+static ledshm_t *ledd_shm;
+
+
+static void ledd_signal(int signum)
+{
+    ledd_stop = 1;
+
+    if (ledd_shm)
+    {
+        ledshm_wake(&ledd_shm->commit);
+    }
+}
+
+static void ledd_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n name] [-f] [-d dma] [-g gpio] [-c count] [-G gpio] [-C count] "
+            "[-s]\n"
+            "  -n  shared memory name, default %s\n"
+            "  -f  remove a segment of that name left behind by a daemon that died\n"
+            "  -d  DMA channel, default %d\n"
+            "  -g  -c  GPIO and LED count of channel 0, default %d and %d\n"
+            "  -G  -C  GPIO and LED count of channel 1, default %d and 0\n"
+            "  -s  use the simulator backend\n",
+            prog, LEDSHM_NAME, LEDD_DMA, LEDD_GPIO0, LEDD_COUNT0, LEDD_GPIO1);
+}
+
+/**
+ * Create the shared segment and fill in its header.  The segment is writable by
+ * everyone, as clients are not expected to run as root.  An existing segment is never
+ * taken over, that would shrink it under the clients of the daemon that owns it.
+ *
+ * @param    name    shm_open() name.
+ * @param    stale   Unlink a segment of that name first.
+ * @param    ws2811  Initialized ws2811 instance.
+ *
+ * @returns  Mapped segment, NULL on error with errno EEXIST if the name is taken.
+ */
+static ledshm_t *ledd_map(const char *name, int stale, ws2811_t *ws2811)
+{
+    uint32_t size = (sizeof(ledshm_t) + LEDD_ALIGN - 1) & ~(LEDD_ALIGN - 1);
+    uint32_t offset[RPI_PWM_CHANNELS];
+    ledshm_t *shm;
+    int chan, fd;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        offset[chan] = size;
+        size += sizeof(ws2811_led_t) * ws2811->channel[chan].count;
+        size = (size + LEDD_ALIGN - 1) & ~(LEDD_ALIGN - 1);
+    }
+
+    if (stale)
+    {
+        shm_unlink(name);
+    }
+
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if (fchmod(fd, 0666) || ftruncate(fd, size))
+    {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    shm->version = LEDSHM_VERSION;
+    shm->size = size;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        shm->count[chan] = ws2811->channel[chan].count;
+        shm->offset[chan] = offset[chan];
+        shm->brightness[chan] = ws2811->channel[chan].brightness;
+    }
+
+    // Clients check the magic last
+    __atomic_store_n(&shm->magic, LEDSHM_MAGIC, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+/**
+ * Render every commit until told to stop.
+ *
+ * @param    ws2811  ws2811 instance, with the channels pointing into the segment.
+ * @param    shm     Mapped segment.
+ *
+ * @returns  0 on a clean stop, -1 on error.
+ */
+static int ledd_run(ws2811_t *ws2811, ledshm_t *shm)
+{
+    struct timespec timeout = { LEDD_WAIT_MS / 1000, (LEDD_WAIT_MS % 1000) * 1000000 };
+    uint32_t seen = __atomic_load_n(&shm->commit, __ATOMIC_ACQUIRE);
+    int chan;
+
+    while (!ledd_stop)
+    {
+        uint32_t commit = __atomic_load_n(&shm->commit, __ATOMIC_ACQUIRE);
+
+        if (commit == seen)
+        {
+            ledshm_wait(&shm->commit, seen, &timeout);
+            continue;
+        }
+        seen = commit;
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            ws2811->channel[chan].brightness = shm->brightness[chan] & 0xff;
+        }
+
+        // Waits for the previous frame, commits meanwhile go out together next time
+        if (ws2811_render(ws2811))
+        {
+            return -1;
+        }
+
+        __atomic_add_fetch(&shm->frames, ws2811->encoded ? 1 : 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&shm->rendered, seen, __ATOMIC_RELEASE);
+        ledshm_wake(&shm->rendered);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    ws2811_t ws2811;
+    ws2811_led_t *leds[RPI_PWM_CHANNELS];
+    struct sigaction sa;
+    const char *name = LEDSHM_NAME;
+    ledshm_t *shm;
+    int ret, chan, opt, stale = 0;
+
+    memset(&ws2811, 0, sizeof(ws2811));
+    ws2811.freq = WS2811_TARGET_FREQ;
+    ws2811.dmanum = LEDD_DMA;
+    ws2811.channel[0].gpionum = LEDD_GPIO0;
+    ws2811.channel[0].count = LEDD_COUNT0;
+    ws2811.channel[1].gpionum = LEDD_GPIO1;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811.channel[chan].brightness = 255;
+    }
+
+    while ((opt = getopt(argc, argv, "n:fd:g:c:G:C:sh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': name = optarg; break;
+            case 'f': stale = 1; break;
+            case 'd': ws2811.dmanum = atoi(optarg); break;
+            case 'g': ws2811.channel[0].gpionum = atoi(optarg); break;
+            case 'c': ws2811.channel[0].count = atoi(optarg); break;
+            case 'G': ws2811.channel[1].gpionum = atoi(optarg); break;
+            case 'C': ws2811.channel[1].count = atoi(optarg); break;
+            case 's': ws2811.backend = WS2811_BACKEND_SIM; break;
+            default:
+                ledd_usage(argv[0]);
+                return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    if (ws2811_init(&ws2811))
+    {
+        fprintf(stderr, "ledd: ws2811_init failed\n");
+        return -1;
+    }
+
+    shm = ledd_map(name, stale, &ws2811);
+    if (!shm)
+    {
+        if (errno == EEXIST)
+        {
+            fprintf(stderr, "ledd: %s is in use by another daemon, -f if that one is gone\n",
+                    name);
+        }
+        else
+        {
+            perror("ledd: shared memory");
+        }
+        ws2811_fini(&ws2811);
+        return -1;
+    }
+    ledd_shm = shm;
+
+    // No SA_RESTART, the handler wakes the futex wait to get out
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ledd_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Render straight from the segment, the library's own buffers are put back for fini
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        leds[chan] = ws2811.channel[chan].leds;
+        ws2811.channel[chan].leds = ledshm_leds(shm, chan);
+    }
+
+    ret = ledd_run(&ws2811, shm);
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811.channel[chan].leds = leds[chan];
+    }
+
+    ledd_shm = NULL;
+    ws2811_fini(&ws2811);
+    munmap(shm, shm->size);
+    shm_unlink(name);
+
+    return ret;
+}
@@ -0,0 +1,124 @@
+/*
+ * ledshm.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#ifndef __LEDSHM_H__
+#define __LEDSHM_H__
+
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "ws2811.h"
+
+
+/*
+ * Shared memory segment of the LED daemon, ledd.  The daemon owns the hardware and
+ * maps the segment at /dev/shm/<name>; any process that can open it writes LEDs
+ * straight into the channel arrays and calls ledshm_commit().  The daemon renders the
+ * LEDs as they are when it picks up a commit, so commits that come in while the
+ * previous frame is still being sent are merged into one frame.
+ *
+ * A client that must not have a frame picked up half written waits for .rendered to
+ * reach the value ledshm_commit() returned before writing the next one.
+ */
+#define LEDSHM_NAME                              "/ws2811"
+#define LEDSHM_MAGIC                             0x4c454453   // LEDS
+#define LEDSHM_VERSION                           1
+
+
+typedef struct
+{
+    uint32_t magic;                              //< LEDSHM_MAGIC
+    uint32_t version;                            //< LEDSHM_VERSION
+    uint32_t size;                               //< Size of the segment in bytes
+    uint32_t count[RPI_PWM_CHANNELS];            //< LEDs on each channel
+    uint32_t offset[RPI_PWM_CHANNELS];           //< Offset of each channel's LEDs in the segment
+    uint32_t brightness[RPI_PWM_CHANNELS];       //< Brightness, picked up with the next commit
+    uint32_t commit;                             //< Commits so far, futex word the daemon waits on
+    uint32_t rendered;                           //< Last commit handed to the DMA, futex word
+    uint32_t frames;                             //< Frames rendered
+} ledshm_t;
+
+
+static inline ws2811_led_t *ledshm_leds(ledshm_t *shm, int chan)
+{
+    return (ws2811_led_t *)((uint8_t *)shm + shm->offset[chan]);
+}
+
+static inline void ledshm_wake(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+static inline void ledshm_wait(uint32_t *word, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+/**
+ * Tell the daemon the LEDs are ready to be shown.
+ *
+ * @param    shm  Mapped segment.
+ *
+ * @returns  Commit number, the daemon sets .rendered to it or later once picked up.
+ */
+static inline uint32_t ledshm_commit(ledshm_t *shm)
+{
+    uint32_t commit = __atomic_add_fetch(&shm->commit, 1, __ATOMIC_RELEASE);
+
+    ledshm_wake(&shm->commit);
+
+    return commit;
+}
+
+/**
+ * Wait until the daemon picked up a commit, after which the LEDs can be changed again.
+ *
+ * @param    shm     Mapped segment.
+ * @param    commit  Value returned by ledshm_commit().
+ *
+ * @returns  None
+ */
+static inline void ledshm_wait_rendered(ledshm_t *shm, uint32_t commit)
+{
+    uint32_t rendered;
+
+    while ((int32_t)((rendered = __atomic_load_n(&shm->rendered, __ATOMIC_ACQUIRE)) - commit) < 0)
+    {
+        ledshm_wait(&shm->rendered, rendered, NULL);
+    }
+}
+
+
+#endif /* __LEDSHM_H__ */
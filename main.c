@@ -1,10 +1,26 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include "ws2811.h"
+#include "layout.h"
+#include "forecast.h"
 
 
 #define ARRAY_SIZE(stuff)                        (sizeof(stuff) / sizeof(stuff[0]))
@@ -17,6 +33,14 @@
 #define HEIGHT                                   14
 #define LED_COUNT                                (WIDTH * HEIGHT)
 
+#define FB_SHIFT                                 8            // Q8.8 channels
+#define FB_FADE                                  251          // 0.98 in Q0.8
+
+#define FRAMES_PER_SECOND                        30
+
+#define FORECAST_DIR                             "/home/pi/rpi_ws281x"
+#define FORECAST_NAME                            "forecast"
+
 
 ws2811_t ledstring =
         {
@@ -40,10 +64,14 @@ struct RGB {
     int b;
 };
 
-struct XRGB {
-    float r;
-    float g;
-    float b;
+/*
+ * Effect framebuffer, one Q8.8 plane per channel in row-major order, so that pixel
+ * (x, y) sits at the LED index y * WIDTH + x of the strip.
+ */
+struct framebuffer {
+    uint16_t r[LED_COUNT];
+    uint16_t g[LED_COUNT];
+    uint16_t b[LED_COUNT];
 };
 
 float dotposition[]     = {15, 4, 11, 8, 0, 12, 6, 10, 2, 13, 3, 14, 5, 9, 1};
@@ -61,7 +89,36 @@ ws2811_led_t dotcolors[] =
                 0xAA8439, 0xAA7939, 0xAA6C39, 0xAA5939, 0xAA3939
         };
 
-struct XRGB matrix[WIDTH][HEIGHT];
+struct framebuffer matrix;
+ws2811_led_t matrix_packed[LED_COUNT];
+layout_t layout;
+
+/*
+ * Effect inputs.  update_forecast() bumps the version of every input whose values changed,
+ * the derived values below are rebuilt from them by effects_update().
+ */
+enum effect_input {
+    INPUT_FORECAST,
+    INPUT_WIND,
+    INPUT_PRECIP,
+    INPUT_COUNT,
+};
+
+unsigned input_version[INPUT_COUNT] = {1, 1, 1};
+
+/*
+ * Per row values the frames are drawn from, constant between forecast updates.
+ */
+struct row_derived {
+    ws2811_led_t color;     // forecast_color(), the background of the row
+    struct RGB target;      // color split up, the fade target
+    ws2811_led_t dot;       // Wind dot, twice as bright
+    float speed;            // Wind dot speed in pixels per frame
+    int precip;             // precip_level()
+};
+
+struct row_derived rows[HEIGHT];
+ws2811_led_t precip_palette[ARRAY_SIZE(dotcolors)];
 
 ws2811_led_t createRGB(int r, int g, int b) {
     return (ws2811_led_t) (((g & 0xff) << 16) + ((b & 0xff) << 8) + (r & 0xff));
@@ -75,14 +132,6 @@ struct RGB getRGB(int hexValue) {
     return rgbColor;
 }
 
-struct XRGB getXRGB(int hexValue) {
-    struct XRGB rgbColor;
-    rgbColor.g = (hexValue >> 16) & 0xff;
-    rgbColor.b = (hexValue >> 8) & 0xff;
-    rgbColor.r = hexValue & 0xff;
-    return rgbColor;
-}
-
 ws2811_led_t up(ws2811_led_t color, float m) {
     struct RGB rgb = getRGB(color);
     rgb.r = (int) (rgb.r * m);
@@ -92,16 +141,43 @@ ws2811_led_t up(ws2811_led_t color, float m) {
 }
 
 
-void matrix_render(void) {
-    int x, y;
+void matrix_set(int x, int y, ws2811_led_t color) {
+    struct RGB rgb = getRGB(color);
+    int i = (y * WIDTH) + x;
+
+    matrix.r[i] = rgb.r << FB_SHIFT;
+    matrix.g[i] = rgb.g << FB_SHIFT;
+    matrix.b[i] = rgb.b << FB_SHIFT;
+}
+
+void matrix_fill_row(int y, ws2811_led_t color) {
+    int x;
 
     for (x = 0; x < WIDTH; x++) {
-        for (y = 0; y < HEIGHT; y++) {
-            struct XRGB xrgb = matrix[x][y];
-            ledstring.channel[0].leds[(y * WIDTH) + x] =
-                    createRGB((int) xrgb.r, (int) xrgb.g, (int) xrgb.b);
-        }
+        matrix_set(x, y, color);
+    }
+}
+
+static inline ws2811_led_t matrix_pixel(uint16_t r, uint16_t g, uint16_t b) {
+    return ((uint32_t) (g >> FB_SHIFT) << 16) | ((uint32_t) (b >> FB_SHIFT) << 8) | (r >> FB_SHIFT);
+}
+
+/*
+ * Convert the framebuffer into packed pixels in one streaming pass, then let the layout
+ * copy them onto the LEDs, a memcpy() for every run that is already in order.
+ */
+void matrix_render(void) {
+    ws2811_led_t *restrict packed = matrix_packed;
+    const uint16_t *restrict r = matrix.r;
+    const uint16_t *restrict g = matrix.g;
+    const uint16_t *restrict b = matrix.b;
+    int i;
+
+    for (i = 0; i < LED_COUNT; i++) {
+        packed[i] = matrix_pixel(r[i], g[i], b[i]);
     }
+
+    layout_apply(&layout, packed, ledstring.channel[0].leds);
 }
 
 ws2811_led_t forecast_color(int y) {
@@ -115,44 +191,62 @@ ws2811_led_t forecast_color(int y) {
     }
 
     int pos = (int) ((float) ARRAY_SIZE(dotcolors) / a * f);
+    if (pos >= (int) ARRAY_SIZE(dotcolors)) {
+        pos = ARRAY_SIZE(dotcolors) - 1;
+    }
     ws2811_led_t color = up(dotcolors[pos], 0.3);
     return color;
 }
 
-void matrix_fade() {
-    int x, y;
+static inline uint16_t fade_q8(uint32_t v) {
+    return (v * FB_FADE) >> 8;
+}
 
-    for (y = 0; y < HEIGHT; y++) {
-        for (x = 0; x < WIDTH; x++) {
-            struct RGB rgb = getRGB(forecast_color(y));
-            struct XRGB xrgb = matrix[x][y];
+static inline uint16_t rise_q8(uint32_t v, uint32_t step) {
+    v += step;
+    return v > 0xffff ? 0xffff : v;
+}
 
-            double d = 0.98;
+/*
+ * Pull a run of pixels towards a color: brighter ones fade by 0.98, darker ones gain
+ * 0.02 of the color.  Branch free, so the compiler can vectorize it.
+ */
+static void fade_run(uint16_t *restrict r, uint16_t *restrict g, uint16_t *restrict b,
+                     int n, struct RGB target) {
+    uint32_t target_r = target.r << FB_SHIFT;
+    uint32_t step_r = target.r * (256 - FB_FADE);
+    uint32_t step_g = target.g * (256 - FB_FADE);
+    uint32_t step_b = target.b * (256 - FB_FADE);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uint32_t above = r[i] > target_r;
+        uint16_t vr = above ? fade_q8(r[i]) : r[i];
+        uint16_t vg = above ? fade_q8(g[i]) : g[i];
+        uint16_t vb = above ? fade_q8(b[i]) : b[i];
+        uint32_t below = vr < target_r;
+
+        r[i] = below ? rise_q8(vr, step_r) : vr;
+        g[i] = below ? rise_q8(vg, step_g) : vg;
+        b[i] = below ? rise_q8(vb, step_b) : vb;
+    }
+}
 
-            if (xrgb.r > rgb.r) {
-                xrgb.r = (float) (xrgb.r * d);
-                xrgb.g = (float) (xrgb.g * d);
-                xrgb.b = (float) (xrgb.b * d);
-            }
-            if (xrgb.r < rgb.r) {
-                xrgb.r += (float) (rgb.r * (1 - d));
-                xrgb.g += (float) (rgb.g * (1 - d));
-                xrgb.b += (float) (rgb.b * (1 - d));
-            }
+void matrix_fade() {
+    int y;
 
-            matrix[x][y] = xrgb;
-        }
+    for (y = 0; y < HEIGHT; y++) {
+        int row = y * WIDTH;
+
+        fade_run(&matrix.r[row], &matrix.g[row], &matrix.b[row], WIDTH, rows[y].target);
     }
 }
 
 void matrix_render_forecast(void) {
-    int x, y;
+    int y;
 
     for (y = 0; y < HEIGHT; y++) {
-        struct XRGB color = getXRGB(forecast_color(y));
-        for (x = 0; x < WIDTH; x++) {
-            matrix[x][y] = color;
-        }
+        matrix_fill_row(y, rows[y].color);
     }
 }
 
@@ -167,11 +261,85 @@ int precip_level(int value) {
     return 0;
 }
 
+static void derive_colors(void) {
+    int y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        rows[y].color = forecast_color(y);
+        rows[y].target = getRGB(rows[y].color);
+        rows[y].dot = up(rows[y].color, 2);
+    }
+}
+
+static void derive_speeds(void) {
+    int y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        rows[y].speed = (float) wind[y] / 1500;
+    }
+}
+
+static void derive_precip(void) {
+    int y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        rows[y].precip = precip_level(precip[y]);
+    }
+}
+
+static void derive_palette(void) {
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(dotcolors); i++) {
+        precip_palette[i] = up(dotcolors[i], .3);
+    }
+}
+
+/*
+ * Derived values and the inputs they are computed from.  A node is rebuilt when the
+ * version of one of its inputs moved since it was last built.
+ */
+struct effect_node {
+    void (*derive)(void);
+    unsigned inputs;        // Bit mask of effect_input
+    int built;
+    unsigned version[INPUT_COUNT];
+};
+
+struct effect_node effect_nodes[] = {
+        {.derive = derive_colors, .inputs = 1 << INPUT_FORECAST},
+        {.derive = derive_speeds, .inputs = 1 << INPUT_WIND},
+        {.derive = derive_precip, .inputs = 1 << INPUT_PRECIP},
+        {.derive = derive_palette, .inputs = 0},
+};
+
+void effects_update(void) {
+    size_t n;
+    int i;
+
+    for (n = 0; n < ARRAY_SIZE(effect_nodes); n++) {
+        struct effect_node *node = &effect_nodes[n];
+        int stale = !node->built;
+
+        for (i = 0; i < INPUT_COUNT; i++) {
+            if ((node->inputs & (1 << i)) && node->version[i] != input_version[i]) {
+                node->version[i] = input_version[i];
+                stale = 1;
+            }
+        }
+
+        if (stale) {
+            node->derive();
+            node->built = 1;
+        }
+    }
+}
+
 void matrix_render_wind(void) {
     int y;
 
     for (y = 0; y < HEIGHT; y++) {
-        int offset = precip_level(precip[y]);
+        int offset = rows[y].precip;
 
         int pos = (int) dotposition[y];
         if (pos >= (WIDTH - (1 + offset))) {
@@ -181,14 +349,14 @@ void matrix_render_wind(void) {
             pos = offset;
         }
 
-        matrix[pos][y] = getXRGB(up(forecast_color(y), 2));
+        matrix_set(pos, y, rows[y].dot);
 
         if (dotposition[y] >= WIDTH - 1 && dotdirection[y] > 0) {
-            dotdirection[y] = -(float) wind[y] / 1500;
+            dotdirection[y] = -rows[y].speed;
         }
 
         if (dotposition[y] <= 0 && dotdirection[y] < 0) {
-            dotdirection[y] = (float) wind[y] / 1500;
+            dotdirection[y] = rows[y].speed;
         }
 
         dotposition[y] = dotposition[y] + dotdirection[y];
@@ -198,7 +366,7 @@ void matrix_render_wind(void) {
 void matrix_render_precip(int counter) {
     int y, x;
     for (y = 0; y < HEIGHT; y++) {
-        int pl = precip_level(precip[y]);
+        int pl = rows[y].precip;
         if (pl > 0) {
             if (counter % 2 == 0) {
                 precippos[y]++;
@@ -206,90 +374,470 @@ void matrix_render_precip(int counter) {
                     precippos[y] = 0;
                 }
             }
-            struct XRGB color = getXRGB(up(dotcolors[precippos[y]], .3));
+            ws2811_led_t color = precip_palette[precippos[y]];
             for (x = 0; x < pl; x++) {
-                int xa = x;
-                int xb = WIDTH - 1 - x;
-                matrix[xa][y] = color;
-                matrix[xb][y] = color;
+                matrix_set(x, y, color);
+                matrix_set(WIDTH - 1 - x, y, color);
             }
         }
     }
 }
 
-void update_forecast(void) {
-    FILE *fp;
-    fp = fopen("/home/pi/rpi_ws281x/forecast", "r");
-    if (fp == NULL) {
-        perror("Error while opening the file.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    int cnt;
-#define BUFFER_SIZE 14 * 3 * sizeof(int)
-    unsigned char buffer[BUFFER_SIZE];
-    fread(buffer, 1, BUFFER_SIZE, fp);
-    for (cnt = 0; cnt < 14; cnt++) {
-        int pos = (int) (cnt * 3 * sizeof(int));
-        forecast[cnt] = buffer[pos + 3] + ((int) buffer[pos + 2] << 8)
-                + ((int) buffer[pos + 1] << 16) + ((int) buffer[pos] << 24);
-        wind[cnt] = buffer[pos + 7] + ((int) buffer[pos + 6] << 8)
-                + ((int) buffer[pos + 5] << 16) + ((int) buffer[pos + 4] << 24);
-        precip[cnt] = buffer[pos + 11] + ((int) buffer[pos + 10] << 8)
-                + ((int) buffer[pos + 9] << 16) + ((int) buffer[pos + 8] << 24);
-        printf("Temp: %d, Wind: %d, Precip: %d\n", forecast[cnt], wind[cnt], precip[cnt]);
-    }
-    fclose(fp);
-}
-
-static void ctrl_c_handler(int signum) {
-    ws2811_fini(&ledstring);
+/*
+ * Forecast as read from the file, handed from the reload thread to the frame loop.  Never
+ * changed once published.
+ */
+struct forecast_snapshot {
+    int values[INPUT_COUNT][ARRAY_SIZE(forecast)];
+};
+
+struct forecast_snapshot *forecast_pending;
+pthread_t forecast_thread;
+int forecast_stop_fd = -1;
+
+/*
+ * Map the forecast file and take its rows, one per matrix row from the top.  Rows past
+ * the matrix are ignored and missing ones stay zero.  A file that is missing or doesn't
+ * check out is left for the next change.  forecast_pack replaces the file by renaming,
+ * so a mapped file is never truncated under us.
+ */
+static int forecast_read(struct forecast_snapshot *snap) {
+    const forecast_header_t *header;
+    struct stat st;
+    void *map;
+    uint32_t row, rows;
+    int fd;
+
+    fd = open(FORECAST_DIR "/" FORECAST_NAME, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("Error while opening the forecast");
+        return -1;
+    }
+
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*header)) {
+        fprintf(stderr, "Forecast is incomplete, keeping the previous one\n");
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error while mapping the forecast");
+        return -1;
+    }
+
+    header = forecast_check(map, st.st_size);
+    if (!header) {
+        fprintf(stderr, "Forecast is not a valid version %d forecast, keeping the previous one\n",
+                FORECAST_VERSION);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    rows = le32toh(header->rows);
+    printf("Forecast of %u rows from %llu\n", rows,
+           (unsigned long long) le64toh(header->timestamp));
+
+    memset(snap, 0, sizeof(*snap));
+    for (row = 0; row < rows && row < ARRAY_SIZE(forecast); row++) {
+        snap->values[INPUT_FORECAST][row] = forecast_value(header, row, FORECAST_FIELD_TEMP);
+        snap->values[INPUT_WIND][row] = forecast_value(header, row, FORECAST_FIELD_WIND);
+        snap->values[INPUT_PRECIP][row] = forecast_value(header, row, FORECAST_FIELD_PRECIP);
+        printf("Temp: %d, Wind: %d, Precip: %d\n", snap->values[INPUT_FORECAST][row],
+               snap->values[INPUT_WIND][row], snap->values[INPUT_PRECIP][row]);
+    }
+
+    munmap(map, st.st_size);
+
+    return 0;
 }
 
-static void setup_handlers(void) {
-    struct sigaction sa =
-            {
-                    .sa_handler = ctrl_c_handler,
-            };
+/*
+ * Read the file into a new snapshot and swap it in.  A snapshot the frame loop hasn't
+ * picked up yet is replaced.
+ */
+static void forecast_publish(void) {
+    struct forecast_snapshot *snap = malloc(sizeof(*snap));
+
+    if (!snap || forecast_read(snap)) {
+        free(snap);
+        return;
+    }
 
-    sigaction(SIGKILL, &sa, NULL);
+    free(__atomic_exchange_n(&forecast_pending, snap, __ATOMIC_ACQ_REL));
 }
 
+/*
+ * Reload thread, reads the forecast whenever the file is closed after writing or renamed
+ * into place, until forecast_stop().
+ */
+static void *forecast_reload(void *arg) {
+    char events[sizeof(struct inotify_event) + NAME_MAX + 1]
+            __attribute__((aligned(__alignof__(struct inotify_event))));
+    int fd = inotify_init1(IN_CLOEXEC);
+
+    if (fd < 0 || inotify_add_watch(fd, FORECAST_DIR, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror("Error while watching the forecast, it won't be reloaded");
+        goto out;
+    }
 
-int main(int argc, char *argv[]) {
-    int frames_per_second = 30;
-    int ret = 0;
+    for (;;) {
+        struct pollfd fds[2] = {
+                {.fd = fd, .events = POLLIN},
+                {.fd = forecast_stop_fd, .events = POLLIN},
+        };
+        int changed = 0;
+        ssize_t len, pos;
 
-    setup_handlers();
-    if (ws2811_init(&ledstring)) {
+        if (poll(fds, ARRAY_SIZE(fds), -1) < 0) {
+            continue;  // EINTR
+        }
+        if (fds[1].revents) {
+            break;
+        }
+
+        len = read(fd, events, sizeof(events));
+        for (pos = 0; pos < len; ) {
+            struct inotify_event *ev = (struct inotify_event *) &events[pos];
+
+            if (ev->len && !strcmp(ev->name, FORECAST_NAME)) {
+                changed = 1;
+            }
+            pos += sizeof(*ev) + ev->len;
+        }
+
+        if (changed) {
+            forecast_publish();
+        }
+    }
+
+out:
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/*
+ * Read the forecast once, then keep reloading it on a thread of its own.
+ */
+static int forecast_start(void) {
+    forecast_publish();
+
+    forecast_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (forecast_stop_fd < 0 || pthread_create(&forecast_thread, NULL, forecast_reload, NULL)) {
+        perror("Error while starting the forecast reload");
+        if (forecast_stop_fd >= 0) {
+            close(forecast_stop_fd);
+        }
         return -1;
     }
 
-    long c = 0;
+    return 0;
+}
+
+static void forecast_stop(void) {
+    uint64_t one = 1;
+
+    if (write(forecast_stop_fd, &one, sizeof(one)) == sizeof(one)) {
+        pthread_join(forecast_thread, NULL);
+    }
+    close(forecast_stop_fd);
+
+    free(__atomic_exchange_n(&forecast_pending, NULL, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Adopt the latest snapshot, if there is a new one, at a frame boundary.
+ */
+void update_forecast(void) {
+    struct forecast_snapshot *snap;
+    int *inputs[INPUT_COUNT] = {forecast, wind, precip};
+    int i;
+
+    if (!__atomic_load_n(&forecast_pending, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    snap = __atomic_exchange_n(&forecast_pending, NULL, __ATOMIC_ACQUIRE);
+
+    // Only what depends on a changed input is derived again
+    for (i = 0; i < INPUT_COUNT; i++) {
+        if (memcmp(inputs[i], snap->values[i], sizeof(snap->values[i]))) {
+            memcpy(inputs[i], snap->values[i], sizeof(snap->values[i]));
+            input_version[i]++;
+        }
+    }
+
+    free(snap);
+}
+
+/*
+ * Frame pacing statistics, intervals between frame ticks as seen by the loop.
+ */
+struct pacing {
+    uint64_t last_ns;
+    uint64_t frames;
+    uint64_t missed;
+    double mean_ns;
+    double m2;
+    double max_ns;
+    double min_ns;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static void pacing_record(struct pacing *p, uint64_t now, uint64_t expirations) {
+    if (expirations > 1) {
+        p->missed += expirations - 1;
+    }
+
+    if (p->last_ns) {
+        double interval = (double) (now - p->last_ns);
+        double delta = interval - p->mean_ns;
+
+        // Welford's running variance
+        p->frames++;
+        p->mean_ns += delta / p->frames;
+        p->m2 += delta * (interval - p->mean_ns);
+
+        if (interval > p->max_ns) {
+            p->max_ns = interval;
+        }
+        if (!p->min_ns || interval < p->min_ns) {
+            p->min_ns = interval;
+        }
+    }
+
+    p->last_ns = now;
+}
+
+static void pacing_dump(const struct pacing *p) {
+    double stddev = p->frames > 1 ? sqrt(p->m2 / (p->frames - 1)) : 0;
+
+    printf("Frames: %llu, missed: %llu, interval mean %.1f us, stddev %.1f us, "
+           "min %.1f us, max %.1f us\n",
+           (unsigned long long) p->frames, (unsigned long long) p->missed,
+           p->mean_ns / 1000, stddev / 1000, p->min_ns / 1000, p->max_ns / 1000);
+}
+
+/*
+ * Signals that stop the loop.  They are blocked before ws2811_init() so that any thread
+ * the library starts inherits the mask, and are read from a signalfd instead.
+ */
+static void shutdown_signals(sigset_t *mask) {
+    sigemptyset(mask);
+    sigaddset(mask, SIGINT);
+    sigaddset(mask, SIGTERM);
+}
+
+static int epoll_add(int epfd, int fd) {
+    struct epoll_event ev = {
+            .events = EPOLLIN,
+            .data.fd = fd,
+    };
+
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Draw the next frame into the LED buffer.
+ */
+static void frame_draw(long c) {
     update_forecast();
-    matrix_render_forecast();
+    effects_update();
+    matrix_fade();
+    matrix_render_wind();
+    matrix_render_precip(c);
+    matrix_render();
+}
+
+/*
+ * Run frames off an absolute timerfd until SIGINT or SIGTERM arrives.  A frame that is
+ * ready while the DMA is still sending the previous one is held until the library's
+ * completion fd fires, so ws2811_render() never blocks the loop.
+ */
+static int run(void) {
+    struct itimerspec period = {
+            .it_interval = {.tv_sec = 0, .tv_nsec = 1000000000 / FRAMES_PER_SECOND},
+    };
+    struct pacing pacing = {0};
+    struct epoll_event events[4];
+    sigset_t mask;
+    int epfd = -1, frame_fd = -1, signal_fd = -1;
+    int dma_fd = ws2811_get_fd(&ledstring);
+    int dma_busy = 0, frame_ready = 0, running = 1;
+    int ret = 0;
+    long c = 0;
 
-    while (1) {
-        matrix_fade();
-        matrix_render_wind();
-        matrix_render_precip(c);
-        matrix_render();
+    shutdown_signals(&mask);
 
-        if (ws2811_render(&ledstring)) {
-            ret = -1;
-            break;
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    frame_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epfd < 0 || frame_fd < 0 || signal_fd < 0) {
+        perror("Error while setting up the event loop");
+        ret = -1;
+        goto out;
+    }
+
+    // First frame one period from now, later ones on the same absolute grid
+    clock_gettime(CLOCK_MONOTONIC, &period.it_value);
+    period.it_value.tv_nsec += period.it_interval.tv_nsec;
+    if (period.it_value.tv_nsec >= 1000000000) {
+        period.it_value.tv_sec++;
+        period.it_value.tv_nsec -= 1000000000;
+    }
+
+    if (timerfd_settime(frame_fd, TFD_TIMER_ABSTIME, &period, NULL) ||
+        epoll_add(epfd, frame_fd) || epoll_add(epfd, signal_fd) || epoll_add(epfd, dma_fd)) {
+        perror("Error while setting up the event loop");
+        ret = -1;
+        goto out;
+    }
+
+    while (running) {
+        int i, n;
+
+        n = epoll_wait(epfd, events, ARRAY_SIZE(events), -1);
+        if (n < 0) {
+            continue;  // EINTR
         }
 
-        usleep((useconds_t) (1000000 / frames_per_second));
-        c++;
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == signal_fd) {
+                struct signalfd_siginfo info;
+
+                if (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    running = 0;
+                }
+            } else if (fd == frame_fd) {
+                uint64_t expirations;
+
+                if (read(frame_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+                    continue;
+                }
 
-        if (c % (frames_per_second * 60 * 5) == 0) {
-            // each 5 minutes update forecast
-            update_forecast();
+                pacing_record(&pacing, monotonic_ns(), expirations);
+                frame_draw(c++);
+                frame_ready = 1;
+            } else if (fd == dma_fd) {
+                int status = ws2811_try_wait(&ledstring);
+
+                if (status < 0) {
+                    ret = -1;
+                    running = 0;
+                } else if (status == 0) {
+                    dma_busy = 0;
+                }
+            }
+        }
+
+        if (frame_ready && !dma_busy && running) {
+            if (ws2811_render(&ledstring)) {
+                ret = -1;
+                break;
+            }
+
+            // Nothing is sent, and no completion comes, when no LED changed
+            dma_busy = ledstring.encoded > 0;
+            frame_ready = 0;
         }
     }
-    ws2811_fini(&ledstring);
+
+    pacing_dump(&pacing);
+
+out:
+    if (signal_fd >= 0) {
+        close(signal_fd);
+    }
+    if (frame_fd >= 0) {
+        close(frame_fd);
+    }
+    if (epfd >= 0) {
+        close(epfd);
+    }
 
     return ret;
 }
 
+
+/*
+ * Pixel layout from the file given with -l, progressive rows of WIDTH otherwise.  Sets
+ * the LED count of the strip.
+ */
+static int layout_setup(int argc, char *argv[]) {
+    layout_geometry_t progressive = {.width = WIDTH, .height = HEIGHT};
+    const char *path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:")) != -1) {
+        if (opt != 'l') {
+            fprintf(stderr, "Usage: %s [-l layout]\n", argv[0]);
+            return -1;
+        }
+        path = optarg;
+    }
+
+    if (path ? layout_load(path, &layout) : layout_compile(&progressive, &layout)) {
+        return -1;
+    }
+
+    if (layout.width != WIDTH || layout.height != HEIGHT) {
+        fprintf(stderr, "Layout is %dx%d, the effects draw %dx%d\n",
+                layout.width, layout.height, WIDTH, HEIGHT);
+        layout_free(&layout);
+        return -1;
+    }
+
+    ledstring.channel[0].count = layout.led_count;
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    sigset_t mask;
+    int ret;
+
+    shutdown_signals(&mask);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL)) {
+        return -1;
+    }
+
+    if (layout_setup(argc, argv)) {
+        return -1;
+    }
+
+    if (ws2811_init(&ledstring)) {
+        layout_free(&layout);
+        return -1;
+    }
+
+    if (forecast_start()) {
+        ws2811_fini(&ledstring);
+        layout_free(&layout);
+        return -1;
+    }
+
+    update_forecast();
+    effects_update();
+    matrix_render_forecast();
+
+    ret = run();
+
+    forecast_stop();
+    ws2811_fini(&ledstring);
+    layout_free(&layout);
+
+    return ret;
+}
@@ -0,0 +1,678 @@
+/*
+ * parallel.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "clk.h"
+#include "gpio.h"
+#include "dma.h"
+#include "pwm.h"
+#include "backend.h"
+
+#include "ws2811.h"
+
+
+/*
+ * Parallel GPIO output engine.  Every WS2811 bit is three time slots: all lanes high,
+ * lanes sending a 0 low, all lanes low.  Each slot is one control block writing a 16
+ * byte burst over set[0], set[1], the reserved word and clr[0], followed by one writing
+ * a dummy word to the PWM FIFO with DREQ flow control.  The PWM drains one word per
+ * slot, so the FIFO writes hold the DMA to the slot rate and every lane changes in the
+ * same cycle.
+ *
+ * The chain only depends on the layout, so it is built once.  Rendering just fills in
+ * the clr[0] word of the middle slot of every bit, which the encoder gets by
+ * transposing the colour bytes of 8 lanes at a time (an 8x8 bit matrix transpose) and
+ * mapping each resulting 8 lane mask onto the GPIO pins through a table.
+ */
+
+
+#define LED_RESET_uS                             55
+#define LED_COLOR_BITS                           24
+#define SLOTS_PER_BIT                            3
+#define SLOT_RANGE                               4            // PWM bits per pacing word
+#define SLOT_BYTES                               16           // set[0], set[1], resvd, clr[0]
+#define SLOT_CLR_WORD                            3
+#define CBS_PER_SLOT                             2            // GPIO burst then FIFO pacing
+#define FIFO_PRIME_WORDS                         16           // Queued before the first slot
+#define LANE_GROUP                               8            // Lanes per transposed block
+#define LANE_GROUPS                              ((WS2811_PARALLEL_MAX_LANES + LANE_GROUP - 1) / \
+                                                  LANE_GROUP)
+#define DMA_POLL_uS                              10
+
+// Data layout: constant all-high and all-low slots, then the pacing word, then bits
+#define DATA_HIGH_OFFSET                         0
+#define DATA_LOW_OFFSET                          SLOT_BYTES
+#define DATA_PACE_OFFSET                         (2 * SLOT_BYTES)
+#define DATA_BITS_OFFSET                         (3 * SLOT_BYTES)
+
+#define RESET_SLOTS(freq)                        ((LED_RESET_uS * SLOTS_PER_BIT * (freq)) / 1000000)
+#define FRAME_SLOTS(count, freq)                 (FIFO_PRIME_WORDS + RESET_SLOTS(freq) + \
+                                                  ((count) * LED_COLOR_BITS * SLOTS_PER_BIT))
+
+
+typedef struct ws2811_parallel_device
+{
+    backend_t *backend;
+    volatile dma_t *dma;
+    volatile pwm_t *pwm;
+    volatile gpio_t *gpio;
+    volatile cm_pwm_t *cm_pwm;
+    dma_mem_t data_mem;                          // Slot data, see DATA_*_OFFSET
+    dma_mem_t cb_mem;                            // Control block chain
+    volatile uint32_t *bits;                     // SLOT_BYTES per bit of every LED
+    uint32_t lane_mask;                          // GPIO bits of all lanes
+    uint32_t lane_lut[LANE_GROUPS][256];         // Lane mask of a group to GPIO bits
+    uint8_t scale[256];                          // Brightness applied to a colour byte
+    int table_brightness;                        // Brightness scale was built for
+    struct timespec dma_deadline;                // Expected completion of the last frame
+} ws2811_parallel_device_t;
+
+
+/**
+ * Transpose an 8x8 bit matrix held one row per byte, so bit j of byte i ends up as
+ * bit i of byte j.
+ *
+ * @param    x  Matrix to transpose.
+ *
+ * @returns  Transposed matrix.
+ */
+static inline uint64_t transpose8(uint64_t x)
+{
+    uint64_t t;
+
+    t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+    x = x ^ t ^ (t << 28);
+
+    return x;
+}
+
+/**
+ * Build the tables mapping each group of 8 lanes onto their GPIO pins.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  None
+ */
+static void lane_lut_build(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    int group, mask, lane;
+
+    device->lane_mask = 0;
+    for (lane = 0; lane < parallel->lanes; lane++)
+    {
+        device->lane_mask |= 1U << parallel->gpionum[lane];
+    }
+
+    for (group = 0; group < LANE_GROUPS; group++)
+    {
+        for (mask = 0; mask < 256; mask++)
+        {
+            uint32_t pins = 0;
+
+            for (lane = 0; lane < LANE_GROUP; lane++)
+            {
+                int index = (group * LANE_GROUP) + lane;
+
+                if ((mask & (1 << lane)) && (index < parallel->lanes))
+                {
+                    pins |= 1U << parallel->gpionum[index];
+                }
+            }
+
+            device->lane_lut[group][mask] = pins;
+        }
+    }
+}
+
+/**
+ * Encode every LED of every lane into the clr[0] words of the data slots.  Bit b of
+ * LED i goes out in slot SLOTS_PER_BIT * ((i * LED_COLOR_BITS) + b) + 1, clearing the
+ * pins of the lanes sending a 0.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  None
+ */
+static void parallel_encode(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    volatile uint32_t *bits = device->bits;
+    const uint8_t *scale = device->scale;
+    int groups = (parallel->lanes + LANE_GROUP - 1) / LANE_GROUP;
+    int count = parallel->count;
+    int i, group, lane, color, bit;
+
+    for (i = 0; i < count; i++)
+    {
+        uint32_t ones[LED_COLOR_BITS] = { 0 };
+
+        for (group = 0; group < groups; group++)
+        {
+            const uint32_t *lut = device->lane_lut[group];
+            uint64_t rows[3] = { 0, 0, 0 };
+            int first = group * LANE_GROUP;
+
+            // Row per lane, in the order the colours go out on the wire
+            for (lane = 0; (lane < LANE_GROUP) && ((first + lane) < parallel->lanes); lane++)
+            {
+                ws2811_led_t led = parallel->leds[((first + lane) * count) + i];
+                int shift = lane * 8;
+
+                rows[0] |= (uint64_t)scale[(led >> 8) & 0xff] << shift;   // Green
+                rows[1] |= (uint64_t)scale[(led >> 16) & 0xff] << shift;  // Red
+                rows[2] |= (uint64_t)scale[led & 0xff] << shift;          // Blue
+            }
+
+            // Byte k of each transposed block holds bit k of every lane, MSB goes first
+            for (color = 0; color < 3; color++)
+            {
+                uint64_t cols = transpose8(rows[color]);
+
+                for (bit = 0; bit < 8; bit++)
+                {
+                    ones[(color * 8) + bit] |= lut[(cols >> ((7 - bit) * 8)) & 0xff];
+                }
+            }
+        }
+
+        for (bit = 0; bit < LED_COLOR_BITS; bit++)
+        {
+            bits[((((i * LED_COLOR_BITS) + bit) * SLOT_BYTES) / sizeof(uint32_t)) +
+                 SLOT_CLR_WORD] = device->lane_mask & ~ones[bit];
+        }
+    }
+}
+
+/**
+ * Fill in one control block of the chain and link it to the next.
+ *
+ * @returns  Index of the next control block.
+ */
+static uint32_t cb_add(ws2811_parallel_device_t *device, uint32_t index, uint32_t ti,
+                       uint32_t source, uint32_t dest, uint32_t len)
+{
+    volatile dma_cb_t *dma_cb = &((volatile dma_cb_t *)device->cb_mem.virt)[index];
+
+    dma_cb->ti = ti;
+    dma_cb->source_ad = source;
+    dma_cb->dest_ad = dest;
+    dma_cb->txfr_len = len;
+    dma_cb->stride = 0;
+    dma_cb->nextconbk = dma_bus_addr(&device->cb_mem, (index + 1) * sizeof(dma_cb_t));
+
+    return index + 1;
+}
+
+/**
+ * Build the control block chain: prime the PWM FIFO, write the three slots of every bit
+ * each followed by a paced FIFO write, then hold the lanes low for the reset time.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  None
+ */
+static void setup_dma_chain(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    dma_mem_t *data = &device->data_mem;
+    uint32_t slot_ti = RPI_DMA_TI_WAIT_RESP | RPI_DMA_TI_SRC_INC | RPI_DMA_TI_DEST_INC;
+    uint32_t pace_ti = RPI_DMA_TI_NO_WIDE_BURSTS | RPI_DMA_TI_WAIT_RESP |
+                       RPI_DMA_TI_DEST_DREQ | RPI_DMA_TI_PERMAP(5);
+    uint32_t gpio = GPIO_PERIPH + offsetof(gpio_t, set[0]);
+    uint32_t fifo = PWM_PERIPH + offsetof(pwm_t, fif1);
+    uint32_t pace = dma_bus_addr(data, DATA_PACE_OFFSET);
+    uint32_t bits = parallel->count * LED_COLOR_BITS;
+    uint32_t cb = 0, bit;
+
+    cb = cb_add(device, cb, pace_ti, pace, fifo, FIFO_PRIME_WORDS * sizeof(uint32_t));
+
+    for (bit = 0; bit < bits; bit++)
+    {
+        uint32_t middle = dma_bus_addr(data, DATA_BITS_OFFSET + (bit * SLOT_BYTES));
+
+        cb = cb_add(device, cb, slot_ti, dma_bus_addr(data, DATA_HIGH_OFFSET), gpio,
+                    SLOT_BYTES);
+        cb = cb_add(device, cb, pace_ti, pace, fifo, sizeof(uint32_t));
+        cb = cb_add(device, cb, slot_ti, middle, gpio, SLOT_BYTES);
+        cb = cb_add(device, cb, pace_ti, pace, fifo, sizeof(uint32_t));
+        cb = cb_add(device, cb, slot_ti, dma_bus_addr(data, DATA_LOW_OFFSET), gpio,
+                    SLOT_BYTES);
+        cb = cb_add(device, cb, pace_ti, pace, fifo, sizeof(uint32_t));
+    }
+
+    cb = cb_add(device, cb, pace_ti, pace, fifo,
+                RESET_SLOTS(parallel->freq) * sizeof(uint32_t));
+
+    // Terminate the final control block to stop DMA
+    ((volatile dma_cb_t *)device->cb_mem.virt)[cb - 1].nextconbk = 0;
+}
+
+/**
+ * Fill in the constant slots and set every bit to 0.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  None
+ */
+static void data_init(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    volatile uint8_t *data = device->data_mem.virt;
+    volatile uint32_t *high = (volatile uint32_t *)&data[DATA_HIGH_OFFSET];
+    volatile uint32_t *low = (volatile uint32_t *)&data[DATA_LOW_OFFSET];
+    uint32_t bits = parallel->count * LED_COLOR_BITS;
+    uint32_t bit;
+
+    memset((uint8_t *)data, 0, device->data_mem.size);
+
+    high[0] = device->lane_mask;
+    low[SLOT_CLR_WORD] = device->lane_mask;
+
+    for (bit = 0; bit < bits; bit++)
+    {
+        device->bits[((bit * SLOT_BYTES) / sizeof(uint32_t)) + SLOT_CLR_WORD] =
+            device->lane_mask;
+    }
+}
+
+static void stop_pwm(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    volatile pwm_t *pwm = device->pwm;
+    volatile cm_pwm_t *cm_pwm = device->cm_pwm;
+
+    // Turn off the PWM in case already running
+    pwm->ctl = 0;
+    usleep(10);
+
+    // Kill the clock if it was already running
+    cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_KILL;
+    usleep(10);
+    while (cm_pwm->ctl & CM_PWM_CTL_BUSY)
+        ;
+}
+
+/**
+ * Setup PWM channel 1 to drain one FIFO word per slot.  Its output isn't routed to any
+ * pin, it only provides the DREQ.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  None
+ */
+static void setup_pwm(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    volatile dma_t *dma = device->dma;
+    volatile pwm_t *pwm = device->pwm;
+    volatile cm_pwm_t *cm_pwm = device->cm_pwm;
+    uint32_t divisor = OSC_FREQ / (SLOTS_PER_BIT * SLOT_RANGE * parallel->freq);
+
+    stop_pwm(parallel);
+
+    cm_pwm->div = CM_PWM_DIV_PASSWD | CM_PWM_DIV_DIVI(divisor);
+    cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_SRC_OSC;
+    cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_SRC_OSC | CM_PWM_CTL_ENAB;
+    usleep(10);
+    while (!(cm_pwm->ctl & CM_PWM_CTL_BUSY))
+        ;
+
+    pwm->rng1 = SLOT_RANGE;
+    usleep(10);
+    pwm->ctl = RPI_PWM_CTL_CLRF1;
+    usleep(10);
+    pwm->dmac = RPI_PWM_DMAC_ENAB | RPI_PWM_DMAC_PANIC(7) | RPI_PWM_DMAC_DREQ(3);
+    usleep(10);
+    pwm->ctl = RPI_PWM_CTL_USEF1 | RPI_PWM_CTL_MODE1;
+    usleep(10);
+    pwm->ctl |= RPI_PWM_CTL_PWEN1;
+
+    dma->cs = 0;
+    dma->txfr_len = 0;
+}
+
+static int map_registers(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    backend_t *backend = device->backend;
+    uint32_t dma_addr = dmanum_to_phys(parallel->dmanum);
+
+    if (!dma_addr)
+    {
+        return -1;
+    }
+
+    device->dma = backend->map_device(backend, dma_addr, sizeof(dma_t));
+    device->pwm = backend->map_device(backend, PWM, sizeof(pwm_t));
+    device->gpio = backend->map_device(backend, GPIO, sizeof(gpio_t));
+    device->cm_pwm = backend->map_device(backend, CM_PWM, sizeof(cm_pwm_t));
+    if (!device->dma || !device->pwm || !device->gpio || !device->cm_pwm)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void unmap_registers(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    backend_t *backend = device->backend;
+
+    if (device->dma)
+    {
+        backend->unmap_device(backend, device->dma, sizeof(dma_t));
+        device->dma = NULL;
+    }
+
+    if (device->pwm)
+    {
+        backend->unmap_device(backend, device->pwm, sizeof(pwm_t));
+        device->pwm = NULL;
+    }
+
+    if (device->gpio)
+    {
+        backend->unmap_device(backend, device->gpio, sizeof(gpio_t));
+        device->gpio = NULL;
+    }
+
+    if (device->cm_pwm)
+    {
+        backend->unmap_device(backend, device->cm_pwm, sizeof(cm_pwm_t));
+        device->cm_pwm = NULL;
+    }
+}
+
+static void parallel_cleanup(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+
+    free(parallel->leds);
+    parallel->leds = NULL;
+
+    if (device)
+    {
+        unmap_registers(parallel);
+
+        // Stop the simulator, if any, before the memory it works on goes away
+        device->backend->destroy(device->backend);
+
+        dma_free(&device->data_mem);
+        dma_free(&device->cb_mem);
+        free(device);
+    }
+
+    parallel->device = NULL;
+}
+
+
+/*
+ *
+ * Application API Functions
+ *
+ */
+
+
+/**
+ * Allocate and initialize memory, the control block chain, PWM pacing, DMA and GPIO.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int ws2811_parallel_init(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device;
+    uint32_t bits = parallel->count * LED_COLOR_BITS;
+    uint32_t cbs = (bits * SLOTS_PER_BIT * CBS_PER_SLOT) + 2;
+    int lane;
+
+    if ((parallel->lanes < 1) || (parallel->lanes > WS2811_PARALLEL_MAX_LANES) ||
+        (parallel->count < 1) || !parallel->freq)
+    {
+        return -1;
+    }
+
+    for (lane = 0; lane < parallel->lanes; lane++)
+    {
+        if ((parallel->gpionum[lane] < 0) || (parallel->gpionum[lane] > 31))
+        {
+            return -1;
+        }
+    }
+
+    parallel->leds = NULL;
+    parallel->device = calloc(1, sizeof(*parallel->device));
+    if (!parallel->device)
+    {
+        return -1;
+    }
+    device = parallel->device;
+    device->table_brightness = -1;
+
+    switch (parallel->backend)
+    {
+        case WS2811_BACKEND_SIM:
+            device->backend = sim_backend_create(1);
+            break;
+
+        case WS2811_BACKEND_SIM_UNPACED:
+            device->backend = sim_backend_create(0);
+            break;
+
+        default:
+            device->backend = hw_backend_create();
+            break;
+    }
+
+    if (!device->backend)
+    {
+        free(device);
+        parallel->device = NULL;
+        return -1;
+    }
+
+    parallel->leds = calloc(parallel->lanes * parallel->count, sizeof(ws2811_led_t));
+    if (!parallel->leds)
+    {
+        goto err;
+    }
+
+    if (dma_alloc(device->backend, &device->data_mem,
+                  DATA_BITS_OFFSET + (bits * SLOT_BYTES), 0))
+    {
+        goto err;
+    }
+    device->bits = (volatile uint32_t *)&device->data_mem.virt[DATA_BITS_OFFSET];
+
+    if (dma_alloc(device->backend, &device->cb_mem, cbs * sizeof(dma_cb_t), 0))
+    {
+        goto err;
+    }
+
+    lane_lut_build(parallel);
+    data_init(parallel);
+    setup_dma_chain(parallel);
+
+    if (map_registers(parallel))
+    {
+        goto err;
+    }
+
+    // Lanes are plain outputs, starting low
+    for (lane = 0; lane < parallel->lanes; lane++)
+    {
+        gpio_output_set(device->gpio, parallel->gpionum[lane], 1);
+    }
+    device->gpio->clr[0] = device->lane_mask;
+
+    setup_pwm(parallel);
+
+    return 0;
+
+err:
+    parallel_cleanup(parallel);
+
+    return -1;
+}
+
+/**
+ * Shut down DMA, PWM, and cleanup memory.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  None
+ */
+void ws2811_parallel_fini(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_wait(parallel);
+    stop_pwm(parallel);
+
+    parallel_cleanup(parallel);
+}
+
+/**
+ * Wait for any executing DMA operation to complete before returning.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA competion error
+ */
+int ws2811_parallel_wait(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    volatile dma_t *dma = device->dma;
+
+    if (dma->cs & RPI_DMA_CS_ACTIVE)
+    {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &device->dma_deadline,
+                               NULL) == EINTR)
+            ;
+
+        while ((dma->cs & RPI_DMA_CS_ACTIVE) && !(dma->cs & RPI_DMA_CS_ERROR))
+        {
+            usleep(DMA_POLL_uS);
+        }
+    }
+
+    if (dma->cs & RPI_DMA_CS_ERROR)
+    {
+        fprintf(stderr, "DMA Error: %08x\n", dma->debug);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Encode all the lanes and start the DMA.  The chain has a single data buffer, so
+ * this waits for the previous frame before encoding.
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA error.
+ */
+int ws2811_parallel_render(ws2811_parallel_t *parallel)
+{
+    ws2811_parallel_device_t *device = parallel->device;
+    volatile dma_t *dma = device->dma;
+    volatile uint8_t *data = device->data_mem.virt;
+    uint64_t frame_ns;
+    int i;
+
+    if (device->table_brightness != parallel->brightness)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            device->scale[i] = (i * (parallel->brightness + 1)) >> 8;
+        }
+        device->table_brightness = parallel->brightness;
+    }
+
+    if (ws2811_parallel_wait(parallel))
+    {
+        return -1;
+    }
+
+    parallel_encode(parallel);
+
+    // Ensure the CPU data cache is flushed before the DMA is started.
+    __builtin___clear_cache((char *)data, (char *)&data[device->data_mem.size]);
+
+    dma->conblk_ad = device->cb_mem.page[0].bus;
+    dma->cs = RPI_DMA_CS_WAIT_OUTSTANDING_WRITES |
+              RPI_DMA_CS_PANIC_PRIORITY(15) |
+              RPI_DMA_CS_PRIORITY(15) |
+              RPI_DMA_CS_ACTIVE;
+
+    frame_ns = ((uint64_t)FRAME_SLOTS(parallel->count, parallel->freq) * 1000000000) /
+               (SLOTS_PER_BIT * parallel->freq);
+    clock_gettime(CLOCK_MONOTONIC, &device->dma_deadline);
+    frame_ns += device->dma_deadline.tv_nsec;
+    device->dma_deadline.tv_sec += frame_ns / 1000000000;
+    device->dma_deadline.tv_nsec = frame_ns % 1000000000;
+
+    return 0;
+}
+
+/**
+ * Get the GPIO bank 0 level of every slot of the last completed frame, for checking
+ * the encoder and chain off target.  Call after ws2811_parallel_wait().
+ *
+ * @param    parallel  Parallel engine instance pointer.
+ * @param    count     Returns the number of levels.
+ *
+ * @returns  Pointer to the levels, NULL if not using a simulator backend.
+ */
+const uint32_t *ws2811_parallel_sim_gpio(ws2811_parallel_t *parallel, uint32_t *count)
+{
+    if ((parallel->backend != WS2811_BACKEND_SIM) &&
+        (parallel->backend != WS2811_BACKEND_SIM_UNPACED))
+    {
+        *count = 0;
+        return NULL;
+    }
+
+    return sim_gpio_capture(parallel->device->backend, count);
+}
@@ -0,0 +1,203 @@
+/*
+ * rt.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "rt.h"
+
+
+/**
+ * Touch the stack the rendering thread is going to use, so it is already mapped when
+ * the memory is locked.  Kept out of line so the array really is on the stack.
+ *
+ * @returns  None
+ */
+static void __attribute__((noinline)) rt_prefault_stack(void)
+{
+    volatile uint8_t stack[RT_STACK_PREFAULT];
+
+    memset((uint8_t *)stack, 0, sizeof(stack));
+}
+
+/**
+ * Lock all current and future pages of the process into memory.  Locking the current
+ * pages faults them all in, so the heap, LED and DMA buffers are resident from here on.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int rt_lock_memory(void)
+{
+    rt_prefault_stack();
+
+    return mlockall(MCL_CURRENT | MCL_FUTURE) ? -1 : 0;
+}
+
+/**
+ * Undo rt_lock_memory().
+ *
+ * @returns  None
+ */
+void rt_unlock_memory(void)
+{
+    munlockall();
+}
+
+/**
+ * Make the calling thread a real-time thread.
+ *
+ * @param    priority  SCHED_FIFO priority.
+ * @param    cpus      Bit mask of the CPUs to pin the thread to, 0 to leave it as is.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int rt_thread_setup(int priority, uint32_t cpus)
+{
+    struct sched_param param = { .sched_priority = priority };
+    int cpu;
+
+    if (cpus)
+    {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        for (cpu = 0; cpu < 32; cpu++)
+        {
+            if (cpus & (1U << cpu))
+            {
+                CPU_SET(cpu, &set);
+            }
+        }
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        {
+            return -1;
+        }
+    }
+
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+    {
+        return -1;
+    }
+
+    rt_prefault_stack();
+
+    return 0;
+}
+
+/**
+ * Record the scheduling policy and affinity of the calling thread.
+ *
+ * @param    state  Filled in with the current settings.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int rt_thread_save(rt_thread_t *state)
+{
+    struct sched_param param;
+    cpu_set_t set;
+    int cpu;
+
+    if (pthread_getschedparam(pthread_self(), &state->policy, &param) ||
+        pthread_getaffinity_np(pthread_self(), sizeof(set), &set))
+    {
+        return -1;
+    }
+
+    state->priority = param.sched_priority;
+    state->cpus = 0;
+    for (cpu = 0; cpu < 64; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set))
+        {
+            state->cpus |= 1ULL << cpu;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Put the calling thread back to settings recorded by rt_thread_save().
+ *
+ * @param    state  Settings to restore.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int rt_thread_restore(const rt_thread_t *state)
+{
+    struct sched_param param = { .sched_priority = state->priority };
+    cpu_set_t set;
+    int cpu;
+
+    CPU_ZERO(&set);
+    for (cpu = 0; cpu < 64; cpu++)
+    {
+        if (state->cpus & (1ULL << cpu))
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    if (pthread_setschedparam(pthread_self(), state->policy, &param) ||
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Sample the page faults and involuntary context switches of the calling thread.
+ *
+ * @param    usage  Filled in with the counters so far.
+ *
+ * @returns  None
+ */
+void rt_usage_sample(rt_usage_t *usage)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_THREAD, &ru))
+    {
+        memset(&ru, 0, sizeof(ru));
+    }
+
+    usage->faults = ru.ru_minflt + ru.ru_majflt;
+    usage->involuntary = ru.ru_nivcsw;
+}
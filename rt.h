@@ -0,0 +1,67 @@
+/*
+ * rt.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#ifndef __RT_H__
+#define __RT_H__
+
+
+#define RT_STACK_PREFAULT                        (64 * 1024)  // Stack touched before locking
+
+
+/*
+ * Resource usage of the calling thread, for the real-time self check.
+ */
+typedef struct
+{
+    uint64_t faults;                             // Minor and major page faults
+    uint64_t involuntary;                        // Involuntary context switches
+} rt_usage_t;
+
+/*
+ * Scheduling of a thread from before it was made real-time.
+ */
+typedef struct
+{
+    int policy;
+    int priority;
+    uint64_t cpus;                               // Affinity of the first 64 CPUs
+} rt_thread_t;
+
+
+int rt_lock_memory(void);
+void rt_unlock_memory(void);
+int rt_thread_setup(int priority, uint32_t cpus);
+int rt_thread_save(rt_thread_t *state);
+int rt_thread_restore(const rt_thread_t *state);
+void rt_usage_sample(rt_usage_t *usage);
+
+
+#endif /* __RT_H__ */
@@ -0,0 +1,714 @@
+/*
+ * sim.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "clk.h"
+#include "gpio.h"
+#include "dma.h"
+#include "pwm.h"
+#include "backend.h"
+
+
+/*
+ * Simulated hardware backend.  Peripheral register blocks are plain memory, and a
+ * thread plays the part of the clock manager and DMA engine: it sets the clock BUSY
+ * bit once the clock is enabled, and when the DMA is made active it walks the control
+ * block chain, copying words to their destinations.  Words written to the PWM FIFO are
+ * drained at the rate the PWM clock and range registers imply, so a frame takes as long
+ * as it would on the wire (unless the backend is unpaced), and are captured for
+ * inspection.  So is the GPIO level after every write to the bank 0 clear register,
+ * which is the last word of each slot the parallel GPIO engine writes.
+ *
+ * Bus addresses of memory are made up: every page handed to pages_to_bus() gets the
+ * next free simulated bus page, so each run of pages comes out contiguous.  Peripheral
+ * bus addresses map onto the simulated register blocks.
+ */
+
+
+#define SIM_POLL_uS                              20          // Idle register poll interval
+#define SIM_PACE_SLICE_NS                        200000      // Sleep once this far ahead
+#define SIM_MAX_BLOCKS                           8
+
+#define SIM_BUS_BASE                             0x40000000  // L2 coherent alias, like hardware
+#define SIM_BUS_LIMIT                            0x7e000000
+#define PERIPH_BUS_BASE                          0x7e000000
+#define PERIPH_PHYS_BASE                         0x20000000
+#define PERIPH_SPAN                              0x01000000
+
+#define DMA_BLOCK(phys)                          ((((phys) & ~0xfff) == (DMA0 & ~0xfff)) || \
+                                                  ((phys) == DMA15))
+#define DMA_DEBUG_READ_ERROR                     (1 << 2)
+#define DMA_PERMAP_PWM                           5
+
+
+typedef struct
+{
+    uint32_t phys;
+    uint32_t len;
+    uint32_t *regs;
+} sim_block_t;
+
+typedef struct
+{
+    uint32_t *word;
+    uint32_t count;
+    uint32_t alloc;
+} sim_words_t;
+
+typedef struct
+{
+    pthread_t thread;
+    volatile int stop;
+    int paced;                                   // Drain the FIFO at the wire rate
+    pthread_mutex_t lock;                        // Protects everything below
+    uintptr_t *pages;                            // Virtual address of each simulated bus page
+    uint32_t page_count;
+    uint32_t page_alloc;
+    sim_block_t blocks[SIM_MAX_BLOCKS];
+    int block_count;
+    uint32_t *dma;                               // Register blocks the thread emulates
+    uint32_t *pwm;
+    uint32_t *gpio;
+    uint32_t *cm_pwm;
+    sim_words_t fifo;                            // Words drained by the running chain
+    sim_words_t fifo_capture;                    // Words drained by the last complete chain
+    sim_words_t gpio_levels;                     // GPIO levels set by the running chain
+    sim_words_t gpio_capture;                    // GPIO levels set by the last complete chain
+    struct timespec due;                         // Time the FIFO will be drained up to
+} sim_t;
+
+
+static inline uint32_t reg_read(uint32_t *regs, size_t offset)
+{
+    return __atomic_load_n(&regs[offset / sizeof(uint32_t)], __ATOMIC_SEQ_CST);
+}
+
+static inline void reg_write(uint32_t *regs, size_t offset, uint32_t val)
+{
+    __atomic_store_n(&regs[offset / sizeof(uint32_t)], val, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Update bits of a register the driver may be writing at the same time.
+ */
+static void reg_update(uint32_t *regs, size_t offset, uint32_t clear, uint32_t set)
+{
+    uint32_t *reg = &regs[offset / sizeof(uint32_t)];
+    uint32_t val = __atomic_load_n(reg, __ATOMIC_SEQ_CST);
+
+    while (!__atomic_compare_exchange_n(reg, &val, (val & ~clear) | set, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        ;
+}
+
+static void timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+static int64_t timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+    return ((int64_t)(a->tv_sec - b->tv_sec) * 1000000000) + (a->tv_nsec - b->tv_nsec);
+}
+
+/**
+ * Translate a bus address to a pointer into simulated memory or registers.  Called with
+ * the lock held.
+ *
+ * @param    sim  Simulator state.
+ * @param    bus  Bus address.
+ *
+ * @returns  Pointer to the word, NULL if nothing is mapped there.
+ */
+static uint32_t *sim_bus_to_virt(sim_t *sim, uint32_t bus)
+{
+    if ((bus >= PERIPH_BUS_BASE) && (bus < (PERIPH_BUS_BASE + PERIPH_SPAN)))
+    {
+        uint32_t phys = bus - PERIPH_BUS_BASE + PERIPH_PHYS_BASE;
+        int i;
+
+        for (i = 0; i < sim->block_count; i++)
+        {
+            sim_block_t *block = &sim->blocks[i];
+
+            if ((phys >= block->phys) && (phys < (block->phys + block->len)))
+            {
+                return &block->regs[(phys - block->phys) / sizeof(uint32_t)];
+            }
+        }
+
+        return NULL;
+    }
+
+    if ((bus >= SIM_BUS_BASE) && (((bus - SIM_BUS_BASE) >> 12) < sim->page_count))
+    {
+        return (uint32_t *)(sim->pages[(bus - SIM_BUS_BASE) >> 12] + (bus & 0xfff));
+    }
+
+    return NULL;
+}
+
+/**
+ * Emulate the clock manager: BUSY follows ENAB, and drops when the clock is killed.
+ */
+static void sim_clock_update(sim_t *sim)
+{
+    uint32_t ctl;
+
+    if (!sim->cm_pwm)
+    {
+        return;
+    }
+
+    ctl = reg_read(sim->cm_pwm, 0);
+    if ((ctl & CM_PWM_CTL_ENAB) && !(ctl & CM_PWM_CTL_KILL))
+    {
+        if (!(ctl & CM_PWM_CTL_BUSY))
+        {
+            reg_update(sim->cm_pwm, 0, 0, CM_PWM_CTL_BUSY);
+        }
+    }
+    else if (ctl & CM_PWM_CTL_BUSY)
+    {
+        reg_update(sim->cm_pwm, 0, CM_PWM_CTL_BUSY, 0);
+    }
+}
+
+/**
+ * Work out how long the PWM takes to shift one word out of the FIFO, from the clock
+ * source and divider, the range register and the number of channels using the FIFO.
+ *
+ * @returns  Nanoseconds per FIFO word.
+ */
+static uint64_t sim_fifo_word_ns(sim_t *sim)
+{
+    uint32_t clkctl = reg_read(sim->cm_pwm, 0);
+    uint32_t clkdiv = reg_read(sim->cm_pwm, 4);
+    uint32_t ctl = reg_read(sim->pwm, 0);
+    uint32_t range = reg_read(sim->pwm, 0x10);
+    uint64_t divisor = (((clkdiv >> 12) & 0xfff) << 12);
+    uint64_t source = OSC_FREQ;
+    int fifos = 0;
+
+    if ((clkctl & 0xf) == CM_PWM_CTL_SRC_PLLD)
+    {
+        source = PLLD_FREQ;
+    }
+
+    // The fractional part is only used by the MASH filter
+    if (clkctl & CM_PWM_CTL_MASH(3))
+    {
+        divisor += clkdiv & 0xfff;
+    }
+
+    if ((ctl & RPI_PWM_CTL_USEF1) && (ctl & RPI_PWM_CTL_PWEN1))
+    {
+        fifos++;
+    }
+
+    if ((ctl & RPI_PWM_CTL_USEF2) && (ctl & RPI_PWM_CTL_PWEN2))
+    {
+        fifos++;
+    }
+
+    if (!divisor || !range || !fifos)
+    {
+        return 0;
+    }
+
+    return (range * divisor * 1000000000) / (source * 4096 * fifos);
+}
+
+/**
+ * Append a word to a capture buffer, dropping it if the buffer can't grow.
+ */
+static void sim_words_add(sim_words_t *words, uint32_t val)
+{
+    if (words->count == words->alloc)
+    {
+        uint32_t alloc = words->alloc ? words->alloc * 2 : 1024;
+        uint32_t *word = realloc(words->word, alloc * sizeof(uint32_t));
+
+        if (word)
+        {
+            words->word = word;
+            words->alloc = alloc;
+        }
+    }
+
+    if (words->count < words->alloc)
+    {
+        words->word[words->count++] = val;
+    }
+}
+
+/**
+ * Make the words collected by the running chain the captured ones, and reuse the old
+ * capture buffer for the next chain.
+ */
+static void sim_words_complete(sim_words_t *running, sim_words_t *capture)
+{
+    sim_words_t swap = *capture;
+
+    *capture = *running;
+    *running = swap;
+    running->count = 0;
+}
+
+/**
+ * Push a word into the PWM FIFO, sleeping whenever the simulated wire falls behind
+ * the DMA, as the DREQ would hold the real DMA back.
+ */
+static void sim_fifo_push(sim_t *sim, uint32_t val, uint64_t word_ns)
+{
+    struct timespec now;
+
+    sim_words_add(&sim->fifo, val);
+
+    timespec_add_ns(&sim->due, word_ns);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_diff_ns(&sim->due, &now) > SIM_PACE_SLICE_NS)
+    {
+        pthread_mutex_unlock(&sim->lock);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sim->due, NULL) == EINTR)
+            ;
+        pthread_mutex_lock(&sim->lock);
+    }
+}
+
+/**
+ * Write a word to a bus address, with the side effects the hardware would have.
+ *
+ * @returns  0 on success, -1 if nothing is mapped at the address.
+ */
+static int sim_write(sim_t *sim, uint32_t bus, uint32_t val, uint64_t word_ns)
+{
+    uint32_t *word = sim_bus_to_virt(sim, bus);
+    uint32_t *gpio = sim->gpio;
+
+    if (!word)
+    {
+        return -1;
+    }
+
+    if (sim->pwm && (word == &sim->pwm[offsetof(pwm_t, fif1) / sizeof(uint32_t)]))
+    {
+        sim_fifo_push(sim, val, word_ns);
+        return 0;
+    }
+
+    if (gpio && (word >= &gpio[offsetof(gpio_t, set) / sizeof(uint32_t)]) &&
+        (word < &gpio[offsetof(gpio_t, lev) / sizeof(uint32_t)]))
+    {
+        size_t offset = (word - gpio) * sizeof(uint32_t);
+        int bank;
+
+        for (bank = 0; bank < 2; bank++)
+        {
+            size_t lev = offsetof(gpio_t, lev[bank]);
+
+            if (offset == offsetof(gpio_t, set[bank]))
+            {
+                reg_write(gpio, lev, reg_read(gpio, lev) | val);
+            }
+            else if (offset == offsetof(gpio_t, clr[bank]))
+            {
+                reg_write(gpio, lev, reg_read(gpio, lev) & ~val);
+
+                if (!bank)
+                {
+                    sim_words_add(&sim->gpio_levels, reg_read(gpio, lev));
+                }
+            }
+        }
+
+        return 0;
+    }
+
+    __atomic_store_n(word, val, __ATOMIC_SEQ_CST);
+
+    return 0;
+}
+
+/**
+ * Run the control block chain the DMA was started on until it ends or faults.  Called
+ * with the lock held.
+ *
+ * @returns  0 on success, -1 on a bus error.
+ */
+static int sim_dma_run(sim_t *sim)
+{
+    uint32_t *dma = sim->dma;
+    uint32_t cbaddr = reg_read(dma, offsetof(dma_t, conblk_ad));
+    uint64_t word_ns = sim->paced ? sim_fifo_word_ns(sim) : 0;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_diff_ns(&sim->due, &now) < 0)
+    {
+        sim->due = now;
+    }
+
+    sim->fifo.count = 0;
+    sim->gpio_levels.count = 0;
+
+    while (cbaddr)
+    {
+        uint32_t *cb = sim_bus_to_virt(sim, cbaddr);
+        uint32_t ti, src, dest, words, i;
+
+        if (!cb)
+        {
+            return -1;
+        }
+
+        ti = cb[offsetof(dma_cb_t, ti) / sizeof(uint32_t)];
+        src = cb[offsetof(dma_cb_t, source_ad) / sizeof(uint32_t)];
+        dest = cb[offsetof(dma_cb_t, dest_ad) / sizeof(uint32_t)];
+        words = cb[offsetof(dma_cb_t, txfr_len) / sizeof(uint32_t)] / sizeof(uint32_t);
+
+        reg_write(dma, offsetof(dma_t, ti), ti);
+        reg_write(dma, offsetof(dma_t, source_ad), src);
+        reg_write(dma, offsetof(dma_t, dest_ad), dest);
+        reg_write(dma, offsetof(dma_t, nextconbk),
+                  cb[offsetof(dma_cb_t, nextconbk) / sizeof(uint32_t)]);
+
+        for (i = 0; i < words; i++)
+        {
+            uint32_t val = 0;
+
+            if (!(ti & RPI_DMA_TI_SRC_IGNORE))
+            {
+                uint32_t *word = sim_bus_to_virt(sim, src);
+
+                if (!word)
+                {
+                    return -1;
+                }
+
+                val = *word;
+            }
+
+            if (!(ti & RPI_DMA_TI_DEST_IGNORE))
+            {
+                int paced = (ti & RPI_DMA_TI_DEST_DREQ) &&
+                            (((ti >> 16) & 0x1f) == DMA_PERMAP_PWM);
+
+                if (sim_write(sim, dest, val, paced ? word_ns : 0))
+                {
+                    return -1;
+                }
+            }
+
+            if (ti & RPI_DMA_TI_SRC_INC)
+            {
+                src += sizeof(uint32_t);
+            }
+
+            if (ti & RPI_DMA_TI_DEST_INC)
+            {
+                dest += sizeof(uint32_t);
+            }
+        }
+
+        cbaddr = cb[offsetof(dma_cb_t, nextconbk) / sizeof(uint32_t)];
+        reg_write(dma, offsetof(dma_t, conblk_ad), cbaddr);
+    }
+
+    // The DMA is done once the last word is in the FIFO, let the wire catch up
+    pthread_mutex_unlock(&sim->lock);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sim->due, NULL) == EINTR)
+        ;
+    pthread_mutex_lock(&sim->lock);
+
+    return 0;
+}
+
+static void *sim_thread(void *arg)
+{
+    sim_t *sim = arg;
+
+    while (!sim->stop)
+    {
+        int active = 0;
+
+        pthread_mutex_lock(&sim->lock);
+
+        sim_clock_update(sim);
+
+        if (sim->dma && (reg_read(sim->dma, 0) & RPI_DMA_CS_ACTIVE))
+        {
+            active = 1;
+
+            if (sim_dma_run(sim))
+            {
+                reg_write(sim->dma, offsetof(dma_t, debug), DMA_DEBUG_READ_ERROR);
+                reg_update(sim->dma, 0, RPI_DMA_CS_ACTIVE, RPI_DMA_CS_ERROR);
+            }
+            else
+            {
+                sim_words_complete(&sim->fifo, &sim->fifo_capture);
+                sim_words_complete(&sim->gpio_levels, &sim->gpio_capture);
+
+                reg_update(sim->dma, 0, RPI_DMA_CS_ACTIVE, RPI_DMA_CS_END);
+            }
+        }
+
+        pthread_mutex_unlock(&sim->lock);
+
+        if (!active)
+        {
+            usleep(SIM_POLL_uS);
+        }
+    }
+
+    return NULL;
+}
+
+static void *sim_map_device(backend_t *backend, const uint32_t phys, const uint32_t len)
+{
+    sim_t *sim = backend->priv;
+    sim_block_t *block;
+    uint32_t *regs;
+
+    if (sim->block_count == SIM_MAX_BLOCKS)
+    {
+        return NULL;
+    }
+
+    regs = calloc(1, (len + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1));
+    if (!regs)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sim->lock);
+
+    block = &sim->blocks[sim->block_count++];
+    block->phys = phys;
+    block->len = len;
+    block->regs = regs;
+
+    if (DMA_BLOCK(phys))
+    {
+        sim->dma = regs;
+    }
+    else if (phys == PWM)
+    {
+        sim->pwm = regs;
+    }
+    else if (phys == GPIO)
+    {
+        sim->gpio = regs;
+    }
+    else if (phys == CM_PWM)
+    {
+        sim->cm_pwm = regs;
+    }
+
+    pthread_mutex_unlock(&sim->lock);
+
+    return regs;
+}
+
+/**
+ * Register blocks stay allocated until the backend is destroyed, as the simulator
+ * thread may still be looking at them.
+ */
+static void sim_unmap_device(backend_t *backend, volatile void *addr, const uint32_t len)
+{
+}
+
+static int sim_pages_to_bus(backend_t *backend, const volatile void *addr, uint32_t pages,
+                            uint32_t *bus)
+{
+    sim_t *sim = backend->priv;
+    uintptr_t virt = (uintptr_t)addr & PAGE_MASK;
+    uint32_t i;
+
+    pthread_mutex_lock(&sim->lock);
+
+    if (((uint64_t)(sim->page_count + pages) << 12) > (SIM_BUS_LIMIT - SIM_BUS_BASE))
+    {
+        pthread_mutex_unlock(&sim->lock);
+        return -1;
+    }
+
+    if ((sim->page_count + pages) > sim->page_alloc)
+    {
+        uint32_t alloc = sim->page_alloc ? sim->page_alloc : 256;
+        uintptr_t *table;
+
+        while (alloc < (sim->page_count + pages))
+        {
+            alloc *= 2;
+        }
+
+        table = realloc(sim->pages, alloc * sizeof(uintptr_t));
+        if (!table)
+        {
+            pthread_mutex_unlock(&sim->lock);
+            return -1;
+        }
+
+        sim->pages = table;
+        sim->page_alloc = alloc;
+    }
+
+    // Each run gets fresh bus pages, so it is always contiguous on the simulated bus
+    for (i = 0; i < pages; i++)
+    {
+        bus[i] = SIM_BUS_BASE + (sim->page_count << 12);
+        sim->pages[sim->page_count++] = virt + (i * PAGE_SIZE);
+    }
+
+    pthread_mutex_unlock(&sim->lock);
+
+    return 0;
+}
+
+static void sim_destroy(backend_t *backend)
+{
+    sim_t *sim = backend->priv;
+    int i;
+
+    sim->stop = 1;
+    pthread_join(sim->thread, NULL);
+
+    for (i = 0; i < sim->block_count; i++)
+    {
+        free(sim->blocks[i].regs);
+    }
+
+    pthread_mutex_destroy(&sim->lock);
+    free(sim->pages);
+    free(sim->fifo.word);
+    free(sim->fifo_capture.word);
+    free(sim->gpio_levels.word);
+    free(sim->gpio_capture.word);
+    free(sim);
+    free(backend);
+}
+
+/**
+ * Get the words the PWM FIFO received during the last complete DMA chain.  The buffer
+ * is replaced when the next chain completes, so call this after ws2811_wait().
+ *
+ * @param    backend  Simulator backend.
+ * @param    count    Returns the number of words.
+ *
+ * @returns  Pointer to the captured words.
+ */
+const uint32_t *sim_fifo_capture(backend_t *backend, uint32_t *count)
+{
+    sim_t *sim = backend->priv;
+    const uint32_t *capture;
+
+    pthread_mutex_lock(&sim->lock);
+    capture = sim->fifo_capture.word;
+    *count = sim->fifo_capture.count;
+    pthread_mutex_unlock(&sim->lock);
+
+    return capture;
+}
+
+/**
+ * Get the bank 0 GPIO levels after each write to the bank 0 clear register during the
+ * last complete DMA chain.  The buffer is replaced when the next chain completes.
+ *
+ * @param    backend  Simulator backend.
+ * @param    count    Returns the number of levels.
+ *
+ * @returns  Pointer to the captured levels.
+ */
+const uint32_t *sim_gpio_capture(backend_t *backend, uint32_t *count)
+{
+    sim_t *sim = backend->priv;
+    const uint32_t *capture;
+
+    pthread_mutex_lock(&sim->lock);
+    capture = sim->gpio_capture.word;
+    *count = sim->gpio_capture.count;
+    pthread_mutex_unlock(&sim->lock);
+
+    return capture;
+}
+
+/**
+ * Create the simulator backend.
+ *
+ * @param    paced  Drain the PWM FIFO at the rate the registers imply, rather than
+ *                  completing each chain as fast as it can be copied.
+ *
+ * @returns  Backend, or NULL on error.
+ */
+backend_t *sim_backend_create(int paced)
+{
+    backend_t *backend = malloc(sizeof(*backend));
+    sim_t *sim = calloc(1, sizeof(*sim));
+
+    if (!backend || !sim)
+    {
+        free(backend);
+        free(sim);
+        return NULL;
+    }
+
+    pthread_mutex_init(&sim->lock, NULL);
+    sim->paced = paced;
+
+    backend->map_device = sim_map_device;
+    backend->unmap_device = sim_unmap_device;
+    backend->pages_to_bus = sim_pages_to_bus;
+    backend->destroy = sim_destroy;
+    backend->priv = sim;
+
+    if (pthread_create(&sim->thread, NULL, sim_thread, sim))
+    {
+        pthread_mutex_destroy(&sim->lock);
+        free(sim);
+        free(backend);
+        return NULL;
+    }
+
+    return backend;
+}
@@ -0,0 +1,278 @@
+/*
+ * simd.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "simd.h"
+
+
+/*
+ * Each color byte expands to 8 symbols of 3 bits, MSB first, where a symbol is 1 b 0
+ * for data bit b.  That is the constant 0x924924 with the data bits spread out to every
+ * third bit position, starting at bit 1.
+ *
+ * 4 LEDs of GRB bytes make up the 12 patterns g0 r0 b0 g1 r1 b1 g2 r2 b2 g3 r3 b3 of 24
+ * bits, which pack into the 9 output words as:
+ *
+ *     w0 = g0 << 8  | r0 >> 16      w1 = r0 << 16 | b0 >> 8       w2 = b0 << 24 | g1
+ *     w3 = r1 << 8  | b1 >> 16      w4 = b1 << 16 | g2 >> 8       w5 = g2 << 24 | r2
+ *     w6 = b2 << 8  | g3 >> 16      w7 = g3 << 16 | r3 >> 8       w8 = r3 << 24 | b3
+ *
+ * With the patterns regrouped across lanes as A = [g0 r1 b2], B = [r0 b1 g3], C = [b0 g2 r3]
+ * and D = [g1 r2 b3], every column above is the same shift for all three lanes:
+ *
+ *     X = [w0 w3 w6] = A << 8 | B >> 16
+ *     Y = [w1 w4 w7] = B << 16 | C >> 8
+ *     Z = [w2 w5 w8] = C << 24 | D
+ *
+ * The two channels are then zipped together so the FIFO words are stored in order.
+ *
+ * Color bytes go through the channel lookup table (gamma, white balance and
+ * brightness) with scalar loads before the LEDs are put in vectors.
+ */
+#define SYMBOL_PATTERN_BASE                      0x924924
+#define SYMBOL_PATTERN_MASK                      0xffffff
+
+
+/**
+ * Map the color bytes of a group of LEDs through a channel lookup table, which holds
+ * 256 entries for each of green, red and blue in turn.
+ */
+static inline void lut_apply(uint32_t *mapped, const uint32_t *leds, const uint8_t *lut)
+{
+    int i;
+
+    for (i = 0; i < SIMD_GROUP_LEDS; i++)
+    {
+        uint32_t led = leds[i];
+
+        mapped[i] = ((uint32_t)lut[(led >> 8) & 0xff] << 8) |
+                    ((uint32_t)lut[256 + ((led >> 16) & 0xff)] << 16) |
+                    lut[512 + (led & 0xff)];
+    }
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+typedef uint32x4_t vec_t;
+
+static inline vec_t vec_spread(vec_t x, vec_t invert)
+{
+    x = vandq_u32(vorrq_u32(x, vshlq_n_u32(x, 8)), vdupq_n_u32(0x0000f00f));
+    x = vandq_u32(vorrq_u32(x, vshlq_n_u32(x, 4)), vdupq_n_u32(0x000c30c3));
+    x = vandq_u32(vorrq_u32(x, vshlq_n_u32(x, 2)), vdupq_n_u32(0x00249249));
+    x = vorrq_u32(vshlq_n_u32(x, 1), vdupq_n_u32(SYMBOL_PATTERN_BASE));
+
+    return veorq_u32(x, invert);
+}
+
+static inline vec_t vec_select(vec_t x, vec_t y, vec_t z)
+{
+    static const uint32_t m0[4] = { ~0U, 0, 0, 0 };
+    static const uint32_t m1[4] = { 0, ~0U, 0, 0 };
+
+    return vbslq_u32(vld1q_u32(m0), x, vbslq_u32(vld1q_u32(m1), y, z));
+}
+
+static inline vec_t vec_rotate(vec_t x)
+{
+    return vextq_u32(x, x, 1);
+}
+
+/**
+ * Expand 4 LEDs of one channel into the 9 words X, Y, Z described above.
+ */
+static inline void vec_expand(const uint32_t *leds, vec_t invert, vec_t *x, vec_t *y,
+                              vec_t *z)
+{
+    vec_t v = vld1q_u32(leds);
+    vec_t bytemask = vdupq_n_u32(0xff);
+    vec_t g = vec_spread(vandq_u32(vshrq_n_u32(v, 8), bytemask), invert);
+    vec_t r = vec_spread(vandq_u32(vshrq_n_u32(v, 16), bytemask), invert);
+    vec_t b = vec_spread(vandq_u32(v, bytemask), invert);
+    vec_t rg = vec_rotate(g), rr = vec_rotate(r), rb = vec_rotate(b);
+    vec_t pa = vec_select(g, r, b);
+    vec_t pb = vec_select(r, b, rg);
+    vec_t pc = vec_select(b, rg, rr);
+    vec_t pd = vec_select(rg, rr, rb);
+
+    *x = vorrq_u32(vshlq_n_u32(pa, 8), vshrq_n_u32(pb, 16));
+    *y = vorrq_u32(vshlq_n_u32(pb, 16), vshrq_n_u32(pc, 8));
+    *z = vorrq_u32(vshlq_n_u32(pc, 24), pd);
+}
+
+static void encode_group(uint32_t *out, const uint32_t *leds0, const uint32_t *leds1,
+                         const uint8_t *lut[2], vec_t invert0, vec_t invert1)
+{
+    uint32_t mapped0[SIMD_GROUP_LEDS], mapped1[SIMD_GROUP_LEDS];
+    vec_t x0, y0, z0, x1, y1, z1;
+    uint32x4x2_t xx, yy, zz;
+
+    lut_apply(mapped0, leds0, lut[0]);
+    lut_apply(mapped1, leds1, lut[1]);
+
+    vec_expand(mapped0, invert0, &x0, &y0, &z0);
+    vec_expand(mapped1, invert1, &x1, &y1, &z1);
+
+    xx = vzipq_u32(x0, x1);
+    yy = vzipq_u32(y0, y1);
+    zz = vzipq_u32(z0, z1);
+
+    vst1q_u32(&out[0], vcombine_u32(vget_low_u32(xx.val[0]), vget_low_u32(yy.val[0])));
+    vst1q_u32(&out[4], vcombine_u32(vget_low_u32(zz.val[0]), vget_high_u32(xx.val[0])));
+    vst1q_u32(&out[8], vcombine_u32(vget_high_u32(yy.val[0]), vget_high_u32(zz.val[0])));
+    vst1q_u32(&out[12], vcombine_u32(vget_low_u32(xx.val[1]), vget_low_u32(yy.val[1])));
+    vst1_u32(&out[16], vget_low_u32(zz.val[1]));
+}
+
+#define vec_invert(val)                          vdupq_n_u32((val) ? SYMBOL_PATTERN_MASK : 0)
+
+#elif defined(__SSE2__)
+
+typedef __m128i vec_t;
+
+static inline vec_t vec_spread(vec_t x, vec_t invert)
+{
+    x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 8)), _mm_set1_epi32(0x0000f00f));
+    x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 4)), _mm_set1_epi32(0x000c30c3));
+    x = _mm_and_si128(_mm_or_si128(x, _mm_slli_epi32(x, 2)), _mm_set1_epi32(0x00249249));
+    x = _mm_or_si128(_mm_slli_epi32(x, 1), _mm_set1_epi32(SYMBOL_PATTERN_BASE));
+
+    return _mm_xor_si128(x, invert);
+}
+
+static inline vec_t vec_select(vec_t x, vec_t y, vec_t z)
+{
+    return _mm_or_si128(_mm_or_si128(_mm_and_si128(x, _mm_setr_epi32(~0, 0, 0, 0)),
+                                     _mm_and_si128(y, _mm_setr_epi32(0, ~0, 0, 0))),
+                        _mm_and_si128(z, _mm_setr_epi32(0, 0, ~0, 0)));
+}
+
+static inline vec_t vec_rotate(vec_t x)
+{
+    return _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+/**
+ * Expand 4 LEDs of one channel into the 9 words X, Y, Z described above.
+ */
+static inline void vec_expand(const uint32_t *leds, vec_t invert, vec_t *x, vec_t *y,
+                              vec_t *z)
+{
+    vec_t v = _mm_loadu_si128((const __m128i *)leds);
+    vec_t bytemask = _mm_set1_epi32(0xff);
+    vec_t g = vec_spread(_mm_and_si128(_mm_srli_epi32(v, 8), bytemask), invert);
+    vec_t r = vec_spread(_mm_and_si128(_mm_srli_epi32(v, 16), bytemask), invert);
+    vec_t b = vec_spread(_mm_and_si128(v, bytemask), invert);
+    vec_t rg = vec_rotate(g), rr = vec_rotate(r), rb = vec_rotate(b);
+    vec_t pa = vec_select(g, r, b);
+    vec_t pb = vec_select(r, b, rg);
+    vec_t pc = vec_select(b, rg, rr);
+    vec_t pd = vec_select(rg, rr, rb);
+
+    *x = _mm_or_si128(_mm_slli_epi32(pa, 8), _mm_srli_epi32(pb, 16));
+    *y = _mm_or_si128(_mm_slli_epi32(pb, 16), _mm_srli_epi32(pc, 8));
+    *z = _mm_or_si128(_mm_slli_epi32(pc, 24), pd);
+}
+
+static void encode_group(uint32_t *out, const uint32_t *leds0, const uint32_t *leds1,
+                         const uint8_t *lut[2], vec_t invert0, vec_t invert1)
+{
+    uint32_t mapped0[SIMD_GROUP_LEDS], mapped1[SIMD_GROUP_LEDS];
+    vec_t x0, y0, z0, x1, y1, z1;
+    vec_t xl, xh, yl, yh, zl, zh;
+
+    lut_apply(mapped0, leds0, lut[0]);
+    lut_apply(mapped1, leds1, lut[1]);
+
+    vec_expand(mapped0, invert0, &x0, &y0, &z0);
+    vec_expand(mapped1, invert1, &x1, &y1, &z1);
+
+    xl = _mm_unpacklo_epi32(x0, x1);
+    xh = _mm_unpackhi_epi32(x0, x1);
+    yl = _mm_unpacklo_epi32(y0, y1);
+    yh = _mm_unpackhi_epi32(y0, y1);
+    zl = _mm_unpacklo_epi32(z0, z1);
+    zh = _mm_unpackhi_epi32(z0, z1);
+
+    _mm_storeu_si128((__m128i *)&out[0], _mm_unpacklo_epi64(xl, yl));
+    _mm_storeu_si128((__m128i *)&out[4],
+                     _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(zl),
+                                                     _mm_castsi128_pd(xl), 2)));
+    _mm_storeu_si128((__m128i *)&out[8], _mm_unpackhi_epi64(yl, zl));
+    _mm_storeu_si128((__m128i *)&out[12], _mm_unpacklo_epi64(xh, yh));
+    _mm_storel_epi64((__m128i *)&out[16], zh);
+}
+
+#define vec_invert(val)                          _mm_set1_epi32((val) ? SYMBOL_PATTERN_MASK : 0)
+
+#endif
+
+
+/**
+ * Encode groups of 4 LEDs from both PWM channels in a single pass, writing the
+ * interleaved FIFO words in order.  Output is bit identical to the table encoder.
+ *
+ * @param    pwm_raw  DMA buffer, pointing at the first word of the first group.
+ * @param    leds0    Channel 0 LEDs, at least groups * 4 entries.
+ * @param    leds1    Channel 1 LEDs, at least groups * 4 entries.
+ * @param    groups   Number of 4 LED groups to encode.
+ * @param    lut      Color lookup table of each channel, green, red then blue.
+ * @param    invert   Non-zero if the channel output is inverted.
+ *
+ * @returns  Number of groups encoded, 0 if no vector unit is available.
+ */
+int simd_encode_dual(uint32_t *pwm_raw, const uint32_t *leds0, const uint32_t *leds1,
+                     int groups, const uint8_t *lut[2], const int invert[2])
+{
+#ifdef SIMD_ENCODER_AVAILABLE
+    vec_t invert0 = vec_invert(invert[0]), invert1 = vec_invert(invert[1]);
+    int i;
+
+    for (i = 0; i < groups; i++)
+    {
+        encode_group(pwm_raw, leds0, leds1, lut, invert0, invert1);
+
+        pwm_raw += SIMD_GROUP_WORDS * 2;
+        leds0 += SIMD_GROUP_LEDS;
+        leds1 += SIMD_GROUP_LEDS;
+    }
+
+    return groups;
+#else
+    return 0;
+#endif
+}
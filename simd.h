@@ -0,0 +1,52 @@
+/*
+ * simd.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+
+/*
+ * The vector encoder is built when the compiler targets NEON (ARMv7 with -mfpu=neon, or
+ * ARMv8) or SSE2 (x86 build hosts).  Otherwise simd_encode_dual() encodes nothing and
+ * the caller falls back to the table encoder.
+ */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__SSE2__)
+#define SIMD_ENCODER_AVAILABLE                   1
+#endif
+
+// 4 LEDs * 72 symbol bits is exactly 9 words, so every group starts on a word boundary
+#define SIMD_GROUP_LEDS                          4
+#define SIMD_GROUP_WORDS                         9
+
+
+int simd_encode_dual(uint32_t *pwm_raw, const uint32_t *leds0, const uint32_t *leds1,
+                     int groups, const uint8_t *lut[2], const int invert[2]);
+
+
+#endif /* __SIMD_H__ */
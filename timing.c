@@ -0,0 +1,216 @@
+/*
+ * timing.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "clk.h"
+#include "pwm.h"
+#include "timing.h"
+
+#include "ws2811.h"
+
+
+/*
+ * Indexed by WS2811_TIMING_*.  The legacy profile keeps the original 3 symbol encoding
+ * clocked by an integer divider of the crystal at whatever ws2811_t.freq asks for.
+ */
+static const timing_t timing_profiles[] =
+{
+    [WS2811_TIMING_DEFAULT] =
+    {
+        .name = "default", .freq = 0, .symbols = 3, .t0h = 1, .t1h = 2,
+        .reset_us = 55, .pll = 0,
+    },
+    // T0H 0.5us, T1H 1.2us, 2.5us per bit: 0.625us symbols give 0.625us and 1.25us
+    [WS2811_TIMING_WS2811_400K] =
+    {
+        .name = "ws2811-400k", .freq = 400000, .symbols = 4, .t0h = 1, .t1h = 2,
+        .reset_us = 50, .pll = 1,
+    },
+    // T0H 0.4us, T1H 0.8us, 1.25us per bit: 0.417us symbols give 0.417us and 0.833us
+    [WS2811_TIMING_WS2812B] =
+    {
+        .name = "ws2812b", .freq = 800000, .symbols = 3, .t0h = 1, .t1h = 2,
+        .reset_us = 50, .pll = 1,
+    },
+    // T0H 0.3us, T1H 0.6us, 1.25us per bit: 0.3125us symbols give 0.3125us and 0.625us
+    [WS2811_TIMING_SK6812] =
+    {
+        .name = "sk6812", .freq = 800000, .symbols = 4, .t0h = 1, .t1h = 2,
+        .reset_us = 80, .pll = 1,
+    },
+    // T0H 0.3-0.45us, T1H 0.75-1us, 1.25us per bit: 0.3125us and 0.9375us
+    [WS2811_TIMING_WS2813] =
+    {
+        .name = "ws2813", .freq = 800000, .symbols = 4, .t0h = 1, .t1h = 3,
+        .reset_us = 280, .pll = 1,
+    },
+};
+
+
+/**
+ * Look up a timing profile and check it can be generated.
+ *
+ * @param    profile  WS2811_TIMING_* value.
+ * @param    freq     Data bit rate for profiles that don't set one.
+ * @param    timing   Filled in with the profile.
+ *
+ * @returns  0 on success, -1 for an unknown profile or an unreachable bit rate.
+ */
+int timing_resolve(int profile, uint32_t freq, timing_t *timing)
+{
+    timing_clock_t clock;
+
+    if ((profile < 0) || (profile >= (int)(sizeof(timing_profiles) / sizeof(timing_profiles[0]))))
+    {
+        return -1;
+    }
+
+    *timing = timing_profiles[profile];
+    if (!timing->freq)
+    {
+        timing->freq = freq;
+    }
+
+    if ((timing->symbols < TIMING_SYMBOLS_MIN) || (timing->symbols > TIMING_SYMBOLS_MAX) ||
+        (timing->t0h < 1) || (timing->t1h <= timing->t0h) || (timing->t1h >= timing->symbols))
+    {
+        return -1;
+    }
+
+    return timing_clock(timing, &clock);
+}
+
+/**
+ * Build the symbols of one data bit, first symbol in the most significant position.
+ *
+ * @param    timing  Timing profile.
+ * @param    bit     Data bit value.
+ *
+ * @returns  timing->symbols bits of symbols.
+ */
+uint32_t timing_symbols(const timing_t *timing, int bit)
+{
+    int high = bit ? timing->t1h : timing->t0h;
+
+    return ((1 << high) - 1) << (timing->symbols - high);
+}
+
+/**
+ * Work out the PWM clock manager settings for a symbol rate of symbols * freq.  The
+ * crystal only has integer division.  PLLD is divided with a fraction through the first
+ * order MASH filter, which needs an integer part of at least 2.
+ *
+ * @param    timing  Timing profile.
+ * @param    clock   Filled in with the clock settings.
+ *
+ * @returns  0 on success, -1 if the divider is out of range.
+ */
+int timing_clock(const timing_t *timing, timing_clock_t *clock)
+{
+    uint64_t rate = (uint64_t)timing->symbols * timing->freq;
+    uint64_t div;
+
+    if (!rate)
+    {
+        return -1;
+    }
+
+    if (timing->pll)
+    {
+        div = (((uint64_t)PLLD_FREQ << 12) + (rate / 2)) / rate;
+        clock->src = CM_PWM_CTL_SRC_PLLD;
+        clock->divi = div >> 12;
+        clock->divf = div & 0xfff;
+        clock->mash = clock->divf ? 1 : 0;
+    }
+    else
+    {
+        clock->src = CM_PWM_CTL_SRC_OSC;
+        clock->divi = OSC_FREQ / rate;
+        clock->divf = 0;
+        clock->mash = 0;
+    }
+
+    if ((clock->divi < (clock->mash ? 2 : 1)) || (clock->divi > 0xfff))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Number of PWM symbols in a frame, including the reset time.
+ *
+ * @param    timing  Timing profile.
+ * @param    leds    LEDs on the longest channel.
+ *
+ * @returns  Symbol count.
+ */
+uint32_t timing_bit_count(const timing_t *timing, uint32_t leds)
+{
+    uint64_t reset = ((uint64_t)timing->reset_us * timing->symbols * timing->freq) / 1000000;
+
+    return (leds * 3 * 8 * timing->symbols) + reset;
+}
+
+/**
+ * Size of a DMA buffer.  Each channel is padded out to the nearest uint32 plus 32 bits
+ * for the idle low/high time, and the channels are interleaved a word at a time.
+ *
+ * @param    timing  Timing profile.
+ * @param    leds    LEDs on the longest channel.
+ *
+ * @returns  Buffer size in bytes.
+ */
+uint32_t timing_byte_count(const timing_t *timing, uint32_t leds)
+{
+    uint32_t bits = timing_bit_count(timing, leds);
+
+    return ((((bits >> 3) & ~0x7) + 4) + 4) * RPI_PWM_CHANNELS;
+}
+
+/**
+ * Time the PWM takes to clock a whole frame out, including the reset time.
+ *
+ * @param    timing  Timing profile.
+ * @param    leds    LEDs on the longest channel.
+ *
+ * @returns  Frame time in nanoseconds.
+ */
+uint64_t timing_frame_ns(const timing_t *timing, uint32_t leds)
+{
+    uint64_t symbols = timing_bit_count(timing, leds);
+
+    return (symbols * 1000000000) / ((uint64_t)timing->symbols * timing->freq);
+}
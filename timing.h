@@ -0,0 +1,75 @@
+/*
+ * timing.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+
+#define TIMING_SYMBOLS_MIN                       2        // Need a high and a low symbol
+#define TIMING_SYMBOLS_MAX                       4        // 8 bits of symbols fit in a word
+
+
+/*
+ * Bit timing of a chip family.  Every data bit is sent as a number of PWM symbols, the
+ * first t0h or t1h of them high.
+ */
+typedef struct
+{
+    const char *name;
+    uint32_t freq;                               // Data bit rate, 0 for ws2811_t.freq
+    int symbols;                                 // PWM symbols per data bit
+    int t0h;                                     // High symbols of a 0 bit
+    int t1h;                                     // High symbols of a 1 bit
+    int reset_us;                                // Low time that latches the data
+    int pll;                                     // Clock from PLLD with a fractional divider
+} timing_t;
+
+/*
+ * PWM clock manager settings.
+ */
+typedef struct
+{
+    uint32_t src;                                // CM_PWM_CTL_SRC_*
+    uint32_t divi;                               // Integer part of the divider
+    uint32_t divf;                               // Fraction of the divider in 1/4096
+    uint32_t mash;                               // MASH filter stages, 0 for integer only
+} timing_clock_t;
+
+
+int timing_resolve(int profile, uint32_t freq, timing_t *timing);
+uint32_t timing_symbols(const timing_t *timing, int bit);
+int timing_clock(const timing_t *timing, timing_clock_t *clock);
+uint32_t timing_bit_count(const timing_t *timing, uint32_t leds);
+uint32_t timing_byte_count(const timing_t *timing, uint32_t leds);
+uint64_t timing_frame_ns(const timing_t *timing, uint32_t leds);
+
+
+#endif /* __TIMING_H__ */
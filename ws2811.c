@@ -29,52 +29,87 @@
 
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <signal.h>
+#include <time.h>
+#include <math.h>
 
 #include "clk.h"
 #include "gpio.h"
 #include "dma.h"
 #include "pwm.h"
+#include "simd.h"
+#include "backend.h"
+#include "timing.h"
+#include "rt.h"
 
 #include "ws2811.h"
+#include "driver.h"
 
 
-#define OSC_FREQ                                 19200000   // crystal frequency
+/* 3 colors, 8 bits per byte, timing.symbols per bit + timing.reset_us low for reset signal */
+#define LED_SYMBOL_COUNT(timing)                 (3 * 8 * (timing)->symbols)  // Symbols per LED
 
-/* 3 colors, 8 bits per byte, 3 symbols per bit + 55uS low for reset signal */
-#define LED_RESET_uS                             55
-#define LED_BIT_COUNT(leds, freq)                ((leds * 3 * 8 * 3) + ((LED_RESET_uS * \
-                                                  (freq * 3)) / 1000000))
+// Poll interval once a frame has run past its expected completion time
+#define DMA_POLL_uS                              10
 
-// Pad out to the nearest uint32 + 32-bits for idle low/high times the number of channels
-#define PWM_BYTE_COUNT(leds, freq)               (((((LED_BIT_COUNT(leds, freq) >> 3) & ~0x7) + 4) + 4) * \
-                                                  RPI_PWM_CHANNELS)
-
-#define SYMBOL_HIGH                              0x6  // 1 1 0
-#define SYMBOL_LOW                               0x4  // 1 0 0
+#define SYMBOL_TABLE_SIZE                        256  // One entry per color byte value
+#define COLOR_COUNT                              3    // Green, red, blue, in wire order
 
 #define ARRAY_SIZE(stuff)                        (sizeof(stuff) / sizeof(stuff[0]))
 
 
-typedef struct ws2811_device
+typedef struct
 {
+    dma_mem_t raw_mem;                           // Pages of pwm_raw
+    dma_mem_t cb_mem;                            // Pages of dma_cb
     volatile uint8_t *pwm_raw;
+    volatile dma_cb_t *dma_cb;                   // Control block chain streaming pwm_raw
+    uint32_t dma_cb_addr;
+    uint32_t dma_cb_count;                       // Control blocks in the chain
+    ws2811_led_t *shadow[RPI_PWM_CHANNELS];      // LED values encoded in pwm_raw
+    int shadow_valid[RPI_PWM_CHANNELS];
+} ws2811_buffer_t;
+
+typedef struct ws2811_device
+{
+    backend_t *backend;
+    timing_t timing;                             // Bit timing the buffers are laid out for
     volatile dma_t *dma;
     volatile pwm_t *pwm;
-    volatile dma_cb_t *dma_cb;
-    uint32_t dma_cb_addr;
-    dma_page_t page_head;
     volatile gpio_t *gpio;
     volatile cm_pwm_t *cm_pwm;
     int max_count;
+    ws2811_buffer_t buffer[WS2811_MAX_BUFFERS];
+    int buffer_count;
+    ws2811_buffer_t *buf;                        // Buffer being encoded
+    int dma_buf;                                 // Buffer last started, -1 if none
+    struct timespec dma_deadline;                // Expected completion of the last frame
+    int timer_fd;                                // Armed for dma_deadline, see ws2811_get_fd()
+    int timer_fd_used;                           // ws2811_get_fd() was called, keep timer_fd armed
+    rt_thread_t rt_caller;                       // Scheduling of the ws2811_init() caller before
+    int rt_locked;                               // Memory locked for real-time mode
+    int rt_caller_active;                        // Caller runs real-time, see render_thread_*()
+    uint64_t dma_started_ns;                     // When the last frame was started
+    int dma_pending;                             // Completion of the last frame not yet seen
+    ws2811_stats_t stats;
+    uint64_t stats_dumped_ns;                    // Last periodic dump, see stats_interval
+    uint8_t color_lut[RPI_PWM_CHANNELS][COLOR_COUNT][SYMBOL_TABLE_SIZE];
+    uint32_t symbol_table[RPI_PWM_CHANNELS][COLOR_COUNT][SYMBOL_TABLE_SIZE];
+    int table_brightness[RPI_PWM_CHANNELS];      // Brightness the tables were built for
+    int table_invert[RPI_PWM_CHANNELS];          // Inversion the tables were built for
+    float table_gamma[RPI_PWM_CHANNELS];         // Gamma the tables were built for
+    uint32_t table_white_balance[RPI_PWM_CHANNELS];  // White balance the tables were built for
 } ws2811_device_t;
 
 
@@ -104,61 +139,6 @@ static int max_channel_led_count(ws2811_t *ws2811)
     return max;
 }
 
-/**
- * Map a physical address and length into userspace virtual memory.
- *
- * @param    phys  Physical 32-bit address of device registers.
- * @param    len   Length of mapped region.
- *
- * @returns  Virtual address pointer to physical memory region, NULL on error.
- */
-static void *map_device(const uint32_t phys, const uint32_t len)
-{
-    uint32_t start_page_addr = phys & PAGE_MASK;
-    uint32_t end_page_addr = (phys + len) & PAGE_MASK;
-    uint32_t pages = end_page_addr - start_page_addr + 1;
-    int fd = open("/dev/mem", O_RDWR | O_SYNC);
-    void *virt;
-
-    if (fd < 0)
-    {
-        perror("Can't open /dev/mem");
-        close(fd);
-        return NULL;
-    }
-
-    virt = mmap(NULL, PAGE_SIZE * pages, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
-                start_page_addr);
-    if (virt == MAP_FAILED)
-    {
-        perror("map_device() mmap() failed");
-        close(fd);
-        return NULL;
-    }
-
-    close(fd);
-
-    return (void *)(((uint8_t *)virt) + PAGE_OFFSET(phys));
-}
-
-/**
- * Unmap a physical address and length from virtual memory.
- *
- * @param    addr  Virtual address pointer of device registers.
- * @param    len   Length of mapped region.
- *
- * @returns  None
- */
-static void unmap_device(volatile void *addr, const uint32_t len)
-{
-    uint32_t virt = (uint32_t)addr;
-    uint32_t start_page_addr = virt & PAGE_MASK;
-    uint32_t end_page_addr = (virt + len) & PAGE_MASK;
-    uint32_t pages = end_page_addr - start_page_addr + 1;
-
-    munmap((void *)addr, PAGE_SIZE * pages);
-}
-
 /**
  * Map all devices into userspace memory.
  *
@@ -169,6 +149,7 @@ static void unmap_device(volatile void *addr, const uint32_t len)
 static int map_registers(ws2811_t *ws2811)
 {
     ws2811_device_t *device = ws2811->device;
+    backend_t *backend = device->backend;
     uint32_t dma_addr = dmanum_to_phys(ws2811->dmanum);
 
     if (!dma_addr)
@@ -176,25 +157,25 @@ static int map_registers(ws2811_t *ws2811)
         return -1;
     }
 
-    device->dma = map_device(dma_addr, sizeof(dma_t));
+    device->dma = backend->map_device(backend, dma_addr, sizeof(dma_t));
     if (!device->dma)
     {
         return -1;
     }
 
-    device->pwm = map_device(PWM, sizeof(pwm_t));
+    device->pwm = backend->map_device(backend, PWM, sizeof(pwm_t));
     if (!device->pwm)
     {
         return -1;
     }
 
-    device->gpio = map_device(GPIO, sizeof(gpio_t));
+    device->gpio = backend->map_device(backend, GPIO, sizeof(gpio_t));
     if (!device->gpio)
     {
         return -1;
     }
 
-    device->cm_pwm = map_device(CM_PWM, sizeof(cm_pwm_t));
+    device->cm_pwm = backend->map_device(backend, CM_PWM, sizeof(cm_pwm_t));
     if (!device->cm_pwm)
     {
         return -1;
@@ -213,68 +194,31 @@ static int map_registers(ws2811_t *ws2811)
 static void unmap_registers(ws2811_t *ws2811)
 {
     ws2811_device_t *device = ws2811->device;
+    backend_t *backend = device->backend;
 
     if (device->dma)
     {
-        unmap_device(device->dma, sizeof(dma_t));
+        backend->unmap_device(backend, device->dma, sizeof(dma_t));
+        device->dma = NULL;
     }
 
     if (device->pwm)
     {
-        unmap_device(device->pwm, sizeof(pwm_t));
+        backend->unmap_device(backend, device->pwm, sizeof(pwm_t));
+        device->pwm = NULL;
     }
 
     if (device->cm_pwm)
     {
-        unmap_device(device->cm_pwm, sizeof(cm_pwm_t));
+        backend->unmap_device(backend, device->cm_pwm, sizeof(cm_pwm_t));
+        device->cm_pwm = NULL;
     }
 
     if (device->gpio)
     {
-        unmap_device(device->gpio, sizeof(gpio_t));
-    }
-}
-
-/**
- * Given a userspace address pointer, return the matching bus address used by DMA.
- *     Note: The bus address is not the same as the CPU physical address.
- *
- * @param    addr   Userspace virtual address pointer.
- *
- * @returns  Bus address for use by DMA.
- */
-static uint32_t addr_to_bus(const volatile void *addr)
-{
-    char filename[40];
-    uint64_t pfn;
-    int fd;
-
-    sprintf(filename, "/proc/%d/pagemap", getpid());
-    fd = open(filename, O_RDONLY);
-    if (fd < 0)
-    {
-        perror("addr_to_bus() can't open pagemap");
-        return ~0UL;
-    }
-
-    if (lseek(fd, ((uint32_t)addr >> 12) << 3, SEEK_SET) != 
-        ((uint32_t)addr >> 12) << 3)
-    {
-        perror("addr_to_bus() lseek() failed");
-        close(fd);
-        return ~0UL;
-    }
-
-    if (read(fd, &pfn, sizeof(pfn)) != sizeof(pfn))
-    {
-        perror("addr_to_bus() read() failed");
-        close(fd);
-        return ~0UL;
+        backend->unmap_device(backend, device->gpio, sizeof(gpio_t));
+        device->gpio = NULL;
     }
-
-    close(fd);
-
-    return ((uint32_t)pfn << 12) | 0x40000000 | ((uint32_t)addr & 0xfff);
 }
 
 /**
@@ -301,6 +245,58 @@ static void stop_pwm(ws2811_t *ws2811)
         ;
 }
 
+/**
+ * Build the DMA control block chain that streams a buffer into the PWM FIFO.  Pages
+ * that are contiguous on the bus share a control block, up to the longest transfer
+ * the DMA channel can do.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    buf     Buffer to build the chain for.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int setup_dma_chain(ws2811_t *ws2811, ws2811_buffer_t *buf)
+{
+    volatile dma_cb_t *dma_cb = buf->dma_cb;
+    int maxcount = max_channel_led_count(ws2811);
+    uint32_t byte_count = timing_byte_count(&ws2811->device->timing, maxcount);
+    uint32_t max_len = dmanum_max_txfr_len(ws2811->dmanum);
+    uint32_t offset = 0;
+    uint32_t i;
+
+    if (byte_count > buf->raw_mem.size)
+    {
+        return -1;
+    }
+
+    // Chain together runs of the DMA pages, the last one terminates the chain to stop
+    // DMA.  A run never covers less than a page, so there is a control block for each.
+    for (i = 0; offset < byte_count; i++)
+    {
+        uint32_t len = dma_contiguous_bytes(buf->raw_mem.page, buf->raw_mem.page_count,
+                                            offset, byte_count - offset, max_len);
+
+        dma_cb[i].ti = RPI_DMA_TI_NO_WIDE_BURSTS |  // 32-bit transfers
+                       RPI_DMA_TI_WAIT_RESP |       // wait for write complete
+                       RPI_DMA_TI_DEST_DREQ |       // user peripheral flow control
+                       RPI_DMA_TI_PERMAP(5) |       // PWM peripheral
+                       RPI_DMA_TI_SRC_INC;          // Increment src addr
+
+        dma_cb[i].source_ad = dma_bus_addr(&buf->raw_mem, offset);
+        dma_cb[i].dest_ad = PWM_PERIPH + offsetof(pwm_t, fif1);
+        dma_cb[i].txfr_len = len;
+        dma_cb[i].stride = 0;
+
+        offset += len;
+        dma_cb[i].nextconbk = (offset < byte_count) ?
+                              dma_bus_addr(&buf->cb_mem, (i + 1) * sizeof(dma_cb_t)) : 0;
+    }
+
+    buf->dma_cb_count = i;
+
+    return 0;
+}
+
 /**
  * Setup the PWM controller in serial mode on both channels using DMA to feed the PWM FIFO.
  *
@@ -312,20 +308,22 @@ static int setup_pwm(ws2811_t *ws2811)
 {
     ws2811_device_t *device = ws2811->device;
     volatile dma_t *dma = device->dma;
-    volatile dma_cb_t *dma_cb = device->dma_cb;
     volatile pwm_t *pwm = device->pwm;
     volatile cm_pwm_t *cm_pwm = device->cm_pwm;
-    int maxcount = max_channel_led_count(ws2811);
-    uint32_t freq = ws2811->freq;
-    dma_page_t *page;
-    int32_t byte_count;
+    timing_clock_t clock;
+    int i;
+
+    if (timing_clock(&device->timing, &clock))
+    {
+        return -1;
+    }
 
     stop_pwm(ws2811);
 
-    // Setup the PWM Clock - Use OSC @ 19.2Mhz w/ 3 clocks/tick
-    cm_pwm->div = CM_PWM_DIV_PASSWD | CM_PWM_DIV_DIVI(OSC_FREQ / (3 * freq));
-    cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_SRC_OSC;
-    cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_SRC_OSC | CM_PWM_CTL_ENAB;
+    // Setup the PWM Clock - One clock per symbol, from OSC @ 19.2Mhz or PLLD @ 500Mhz
+    cm_pwm->div = CM_PWM_DIV_PASSWD | CM_PWM_DIV_DIVI(clock.divi) | CM_PWM_DIV_DIVF(clock.divf);
+    cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_MASH(clock.mash) | clock.src;
+    cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_MASH(clock.mash) | clock.src | CM_PWM_CTL_ENAB;
     usleep(10);
     while (!(cm_pwm->ctl & CM_PWM_CTL_BUSY))
         ;
@@ -347,43 +345,21 @@ static int setup_pwm(ws2811_t *ws2811)
     usleep(10);
     pwm->ctl |= RPI_PWM_CTL_PWEN1 | RPI_PWM_CTL_PWEN2;
 
-    // Initialize the DMA control blocks to chain together all the DMA pages
-    page = &device->page_head;
-    byte_count = PWM_BYTE_COUNT(maxcount, freq);
-    while ((page = dma_page_next(&device->page_head, page)) &&
-           byte_count)
+    // Each buffer has its own chain, so starting a frame is just a matter of pointing
+    // the DMA at the right one
+    for (i = 0; i < device->buffer_count; i++)
     {
-        int32_t page_bytes = PAGE_SIZE < byte_count ? PAGE_SIZE : byte_count;
-
-        dma_cb->ti = RPI_DMA_TI_NO_WIDE_BURSTS |  // 32-bit transfers
-                     RPI_DMA_TI_WAIT_RESP |       // wait for write complete
-                     RPI_DMA_TI_DEST_DREQ |       // user peripheral flow control
-                     RPI_DMA_TI_PERMAP(5) |       // PWM peripheral
-                     RPI_DMA_TI_SRC_INC;          // Increment src addr
-
-        dma_cb->source_ad = addr_to_bus(page->addr);
-        if (dma_cb->source_ad == ~0L)
+        if (setup_dma_chain(ws2811, &device->buffer[i]))
         {
             return -1;
         }
 
-        dma_cb->dest_ad = (uint32_t)&((pwm_t *)PWM_PERIPH)->fif1;
-        dma_cb->txfr_len = page_bytes;
-        dma_cb->stride = 0;
-        dma_cb->nextconbk = addr_to_bus(dma_cb + 1);
-
-        byte_count -= page_bytes;
-        if (!dma_page_next(&device->page_head, page))
+        if (device->buffer[i].dma_cb_count > device->stats.dma_cb_count)
         {
-            break;
+            device->stats.dma_cb_count = device->buffer[i].dma_cb_count;
         }
-
-        dma_cb++;
     }
 
-    // Terminate the final control block to stop DMA
-    dma_cb->nextconbk = 0;
-
     dma->cs = 0;
     dma->txfr_len = 0;
 
@@ -391,8 +367,182 @@ static int setup_pwm(ws2811_t *ws2811)
 }
 
 /**
- * Start the DMA feeding the PWM FIFO.  This will stream the entire DMA buffer out of both
- * PWM channels.
+ * Add a number of nanoseconds to a timespec.
+ *
+ * @param    ts  Timespec to update.
+ * @param    ns  Nanoseconds to add.
+ *
+ * @returns  None
+ */
+static void timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000;
+    ts->tv_nsec = ns % 1000000000;
+}
+
+/**
+ * Calculate how long the DMA takes to clock a whole frame out of the PWM, including
+ * the reset time.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  Frame time in nanoseconds.
+ */
+static uint64_t frame_duration_ns(ws2811_t *ws2811)
+{
+    return timing_frame_ns(&ws2811->device->timing, max_channel_led_count(ws2811));
+}
+
+/**
+ * Arm the completion timer fd to become readable at an absolute time.  Nothing is done
+ * until ws2811_get_fd() has been called, which saves a system call per frame for
+ * callers that only use ws2811_wait().
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    when    CLOCK_MONOTONIC time to fire at.
+ *
+ * @returns  None
+ */
+static void timer_fd_arm(ws2811_t *ws2811, const struct timespec *when)
+{
+    struct itimerspec its =
+    {
+        .it_value = *when,
+    };
+
+    if (!ws2811->device->timer_fd_used)
+    {
+        return;
+    }
+
+    timerfd_settime(ws2811->device->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * Read the monotonic clock.
+ *
+ * @returns  Time in nanoseconds.
+ */
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/**
+ * Add a sample to a histogram.  Bucket i counts samples from 2^i up to 2^(i+1) ns,
+ * anything over the last bucket is counted in it.
+ *
+ * @param    hist  Histogram to update.
+ * @param    ns    Sample in nanoseconds.
+ *
+ * @returns  None
+ */
+static void stats_record(ws2811_histogram_t *hist, uint64_t ns)
+{
+    int bucket = 63 - __builtin_clzll(ns | 1);
+
+    if (bucket >= WS2811_STATS_BUCKETS)
+    {
+        bucket = WS2811_STATS_BUCKETS - 1;
+    }
+
+    hist->bucket[bucket]++;
+    hist->count++;
+    hist->total_ns += ns;
+    if (ns > hist->max_ns)
+    {
+        hist->max_ns = ns;
+    }
+}
+
+/**
+ * Find the upper bound of the bucket a percentile of the samples falls in, capped at
+ * the largest sample.
+ *
+ * @param    hist     Histogram.
+ * @param    percent  Percentile, 1 to 100.
+ *
+ * @returns  Upper bound in nanoseconds, 0 if there are no samples.
+ */
+static uint64_t stats_percentile_ns(const ws2811_histogram_t *hist, int percent)
+{
+    uint64_t target = ((hist->count * percent) + 99) / 100;
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < WS2811_STATS_BUCKETS; i++)
+    {
+        seen += hist->bucket[i];
+        if (seen && (seen >= target))
+        {
+            uint64_t bound = (uint64_t)2 << i;
+
+            return (bound < hist->max_ns) ? bound : hist->max_ns;
+        }
+    }
+
+    return 0;
+}
+
+static void stats_print_histogram(const char *name, const ws2811_histogram_t *hist)
+{
+    fprintf(stderr, "ws2811: %-6s n %llu avg %lluus p50 <=%lluus p99 <=%lluus max %lluus\n", name,
+            (unsigned long long)hist->count,
+            (unsigned long long)(hist->count ? hist->total_ns / hist->count / 1000 : 0),
+            (unsigned long long)stats_percentile_ns(hist, 50) / 1000,
+            (unsigned long long)stats_percentile_ns(hist, 99) / 1000,
+            (unsigned long long)hist->max_ns / 1000);
+}
+
+/**
+ * Print the statistics to stderr if stats_interval seconds have passed since the last
+ * time they were printed.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void stats_dump(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_stats_t *stats = &device->stats;
+    uint64_t now;
+
+    if (ws2811->stats_interval <= 0)
+    {
+        return;
+    }
+
+    now = monotonic_ns();
+    if ((now - device->stats_dumped_ns) < ((uint64_t)ws2811->stats_interval * 1000000000))
+    {
+        return;
+    }
+    device->stats_dumped_ns = now;
+
+    fprintf(stderr, "ws2811: frames %llu skipped %llu dropped %llu dma errors %llu (debug %08x) "
+            "frame time %lluus init %lluus dma cbs %u huge %u rt faults %llu preempted %llu\n",
+            (unsigned long long)stats->frames_rendered,
+            (unsigned long long)stats->frames_skipped,
+            (unsigned long long)__atomic_load_n(&stats->frames_dropped, __ATOMIC_RELAXED),
+            (unsigned long long)stats->dma_errors, stats->dma_last_debug,
+            (unsigned long long)frame_duration_ns(ws2811) / 1000,
+            (unsigned long long)stats->init_ns / 1000, stats->dma_cb_count,
+            stats->dma_huge_buffers, (unsigned long long)stats->rt_page_faults,
+            (unsigned long long)stats->rt_involuntary_switches);
+    stats_print_histogram("encode", &stats->encode);
+    stats_print_histogram("wait", &stats->wait);
+    stats_print_histogram("dma", &stats->dma);
+}
+
+/**
+ * Start the DMA feeding the PWM FIFO.  This will stream the entire buffer that was just
+ * encoded out of both PWM channels.
  *
  * @param    ws2811  ws2811 instance pointer.
  *
@@ -402,13 +552,24 @@ static void dma_start(ws2811_t *ws2811)
 {
     ws2811_device_t *device = ws2811->device;
     volatile dma_t *dma = device->dma;
-    uint32_t dma_cb_addr = device->dma_cb_addr;
+    uint32_t dma_cb_addr = device->buf->dma_cb_addr;
+
+    device->dma_buf = device->buf - device->buffer;
 
     dma->conblk_ad = dma_cb_addr;
     dma->cs = RPI_DMA_CS_WAIT_OUTSTANDING_WRITES |
               RPI_DMA_CS_PANIC_PRIORITY(15) | 
               RPI_DMA_CS_PRIORITY(15) |
               RPI_DMA_CS_ACTIVE;
+
+    device->dma_started_ns = monotonic_ns();
+    device->dma_pending = 1;
+    device->stats.frames_rendered++;
+
+    // Note when the frame should be done and have the completion fd fire then
+    clock_gettime(CLOCK_MONOTONIC, &device->dma_deadline);
+    timespec_add_ns(&device->dma_deadline, frame_duration_ns(ws2811));
+    timer_fd_arm(ws2811, &device->dma_deadline);
 }
 
 /**
@@ -444,19 +605,20 @@ static int gpio_init(ws2811_t *ws2811)
 }
 
 /**
- * Initialize the PWM DMA buffer with all zeros for non-inverted operation, or
+ * Initialize a PWM DMA buffer with all zeros for non-inverted operation, or
  * ones for inverted operation.  The DMA buffer length is assumed to be a word 
  * multiple.
  *
  * @param    ws2811  ws2811 instance pointer.
+ * @param    buf     Buffer to initialize.
  *
  * @returns  None
  */
-void pwm_raw_init(ws2811_t *ws2811)
+void pwm_raw_init(ws2811_t *ws2811, ws2811_buffer_t *buf)
 {
-    volatile uint32_t *pwm_raw = (uint32_t *)ws2811->device->pwm_raw;
+    volatile uint32_t *pwm_raw = (uint32_t *)buf->pwm_raw;
     int maxcount = max_channel_led_count(ws2811);
-    int wordcount = (PWM_BYTE_COUNT(maxcount, ws2811->freq) / sizeof(uint32_t)) /
+    int wordcount = (timing_byte_count(&ws2811->device->timing, maxcount) / sizeof(uint32_t)) /
                     RPI_PWM_CHANNELS;
     int chan;
 
@@ -502,19 +664,36 @@ void ws2811_cleanup(ws2811_t *ws2811)
 
     ws2811_device_t *device = ws2811->device;
     if (device) {
+        int i;
+
+        // Stop the simulator, if any, before the memory it works on goes away
+        if (device->backend)
+        {
+            device->backend->destroy(device->backend);
+        }
 
-        if (device->pwm_raw)
+        for (i = 0; i < WS2811_MAX_BUFFERS; i++)
         {
-            dma_page_free((uint8_t *)device->pwm_raw,
-                          PWM_BYTE_COUNT(max_channel_led_count(ws2811),
-                                         ws2811->freq));
-            device->pwm_raw = NULL;
+            ws2811_buffer_t *buf = &device->buffer[i];
+
+            for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+            {
+                if (buf->shadow[chan])
+                {
+                    free(buf->shadow[chan]);
+                }
+            }
+
+            dma_free(&buf->raw_mem);
+            buf->pwm_raw = NULL;
+
+            dma_free(&buf->cb_mem);
+            buf->dma_cb = NULL;
         }
 
-        if (device->dma_cb)
+        if (device->timer_fd >= 0)
         {
-            dma_page_free((dma_cb_t *)device->dma_cb, sizeof(dma_cb_t));
-            device->dma_cb = NULL;
+            close(device->timer_fd);
         }
 
         free(device);
@@ -540,24 +719,98 @@ void ws2811_cleanup(ws2811_t *ws2811)
 int ws2811_init(ws2811_t *ws2811)
 {
     ws2811_device_t *device = NULL;
-    int chan;
+    uint64_t start = monotonic_ns();
+    uint32_t byte_count;
+    timing_t timing;
+    int chan, i;
+
+    if ((ws2811->buffers < 0) || (ws2811->buffers > WS2811_MAX_BUFFERS))
+    {
+        return -1;
+    }
+
+    if (timing_resolve(ws2811->timing, ws2811->freq, &timing))
+    {
+        return -1;
+    }
+    ws2811->freq = timing.freq;
+    byte_count = timing_byte_count(&timing, max_channel_led_count(ws2811));
 
+    ws2811->driver = NULL;
     ws2811->device = malloc(sizeof(*ws2811->device));
     if (!ws2811->device)
     {
         return -1;
     }
     device = ws2811->device;
+    device->timing = timing;
 
     // Initialize all pointers to NULL.  Any non-NULL pointers will be freed on cleanup.
-    device->pwm_raw = NULL;
-    device->dma_cb = NULL;
+    device->dma = NULL;
+    device->pwm = NULL;
+    device->gpio = NULL;
+    device->cm_pwm = NULL;
+    for (i = 0; i < WS2811_MAX_BUFFERS; i++)
+    {
+        ws2811_buffer_t *buf = &device->buffer[i];
+
+        buf->pwm_raw = NULL;
+        buf->dma_cb = NULL;
+        memset(&buf->raw_mem, 0, sizeof(buf->raw_mem));
+        memset(&buf->cb_mem, 0, sizeof(buf->cb_mem));
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            buf->shadow[chan] = NULL;
+            buf->shadow_valid[chan] = 0;
+        }
+    }
+
     for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
     {
         ws2811->channel[chan].leds = NULL;
+
+        // Force the symbol table to be built on the first render
+        device->table_brightness[chan] = -1;
+    }
+
+    device->backend = NULL;
+    device->timer_fd = -1;
+    device->timer_fd_used = 0;
+    device->rt_locked = 0;
+    device->rt_caller_active = 0;
+    device->buffer_count = ws2811->buffers ? ws2811->buffers : 1;
+    device->buf = &device->buffer[0];
+    device->dma_buf = -1;
+    device->dma_pending = 0;
+    memset(&device->stats, 0, sizeof(device->stats));
+    device->stats_dumped_ns = monotonic_ns();
+
+    switch (ws2811->backend)
+    {
+        case WS2811_BACKEND_SIM:
+            device->backend = sim_backend_create(1);
+            break;
+
+        case WS2811_BACKEND_SIM_UNPACED:
+            device->backend = sim_backend_create(0);
+            break;
+
+        default:
+            device->backend = hw_backend_create();
+            break;
+    }
+
+    if (!device->backend)
+    {
+        goto err;
     }
 
-    dma_page_init(&device->page_head);
+    device->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (device->timer_fd < 0)
+    {
+        goto err;
+    }
 
     // Allocate the LED buffers
     for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
@@ -573,31 +826,54 @@ int ws2811_init(ws2811_t *ws2811)
         memset(channel->leds, 0, sizeof(ws2811_led_t) * channel->count);
     }
 
-    // Allocate the DMA buffer
-    device->pwm_raw = dma_alloc(&device->page_head,
-                                PWM_BYTE_COUNT(max_channel_led_count(ws2811),
-                                               ws2811->freq));
-    if (!device->pwm_raw)
+    // Allocate the DMA buffers and control blocks
+    for (i = 0; i < device->buffer_count; i++)
     {
-        goto err;
-    }
+        ws2811_buffer_t *buf = &device->buffer[i];
 
-    pwm_raw_init(ws2811);
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            buf->shadow[chan] = malloc(sizeof(ws2811_led_t) * ws2811->channel[chan].count);
+            if (!buf->shadow[chan])
+            {
+                goto err;
+            }
+        }
 
-    // Allocate the DMA control block
-    device->dma_cb = dma_desc_alloc((PWM_BYTE_COUNT(max_channel_led_count(ws2811),
-                                    ws2811->freq) / PAGE_SIZE));
-    if (!device->dma_cb)
-    {
-        goto err;
+        // Each allocation is translated to bus addresses in one go
+        if (dma_alloc(device->backend, &buf->raw_mem, byte_count,
+                      ws2811->hugepages ? DMA_ALLOC_HUGE : 0))
+        {
+            goto err;
+        }
+        buf->pwm_raw = buf->raw_mem.virt;
+        device->stats.dma_huge_buffers += buf->raw_mem.huge;
+
+        pwm_raw_init(ws2811, buf);
+
+        // At most one control block per page of PWM data
+        if (dma_alloc(device->backend, &buf->cb_mem,
+                      ((byte_count / PAGE_SIZE) + 1) * sizeof(dma_cb_t), 0))
+        {
+            goto err;
+        }
+        buf->dma_cb = (volatile dma_cb_t *)buf->cb_mem.virt;
+        buf->dma_cb_addr = buf->cb_mem.page[0].bus;
     }
-    memset((dma_cb_t *)device->dma_cb, 0, sizeof(dma_cb_t));
 
-    // Cache the DMA control block bus address
-    device->dma_cb_addr = addr_to_bus(device->dma_cb);
-    if (device->dma_cb_addr == ~0L)
+    // Real-time mode, everything the render path touches is allocated by now
+    if (ws2811->rt_priority)
     {
-        goto err;
+        if (rt_thread_save(&device->rt_caller) || rt_lock_memory())
+        {
+            goto err;
+        }
+        device->rt_locked = 1;
+
+        if (render_thread_claim(ws2811))
+        {
+            goto err;
+        }
     }
 
     // Map the physical registers into userspace
@@ -620,9 +896,19 @@ int ws2811_init(ws2811_t *ws2811)
         goto err;
     }
 
+    device->stats.init_ns = monotonic_ns() - start;
+
     return 0;
 
 err:
+    if (ws2811->device)
+    {
+        render_thread_release(ws2811);
+        if (ws2811->device->rt_locked)
+        {
+            rt_unlock_memory();
+        }
+    }
     ws2811_cleanup(ws2811);
 
     return -1;
@@ -637,87 +923,301 @@ err:
  */
 void ws2811_fini(ws2811_t *ws2811)
 {
+    ws2811_driver_stop(ws2811);
     ws2811_wait(ws2811);
     stop_pwm(ws2811);
 
     unmap_registers(ws2811);
 
+    render_thread_release(ws2811);
+    if (ws2811->device->rt_locked)
+    {
+        rt_unlock_memory();
+    }
+
     ws2811_cleanup(ws2811);
 }
 
 /**
- * Wait for any executing DMA operation to complete before returning.
+ * Check the DMA status without blocking.
  *
  * @param    ws2811  ws2811 instance pointer.
  *
- * @returns  0 on success, -1 on DMA competion error
+ * @returns  0 if idle, 1 if still active, -1 on DMA completion error.
  */
-int ws2811_wait(ws2811_t *ws2811)
+static int dma_status(ws2811_t *ws2811)
 {
-    volatile dma_t *dma = ws2811->device->dma;
-
-    while ((dma->cs & RPI_DMA_CS_ACTIVE) &&
-           !(dma->cs & RPI_DMA_CS_ERROR))
-    {
-        usleep(10);
-    }
+    uint32_t cs = ws2811->device->dma->cs;
 
-    if (dma->cs & RPI_DMA_CS_ERROR)
+    if (cs & RPI_DMA_CS_ERROR)
     {
-        fprintf(stderr, "DMA Error: %08x\n", dma->debug);
         return -1;
     }
 
-    return 0;
+    return (cs & RPI_DMA_CS_ACTIVE) ? 1 : 0;
 }
 
 /**
- * Render the PWM DMA buffer from the user supplied LED arrays and start the DMA
- * controller.  This will update all LEDs on both PWM channels.
+ * Wait for any executing DMA operation to complete before returning.  Sleeps until
+ * the frame is expected to be done, then polls until the DMA goes idle.
  *
  * @param    ws2811  ws2811 instance pointer.
  *
- * @returns  None
+ * @returns  0 on success, -1 on DMA competion error
  */
-int ws2811_render(ws2811_t *ws2811)
+int ws2811_wait(ws2811_t *ws2811)
 {
-    volatile uint8_t *pwm_raw = ws2811->device->pwm_raw;
-    int maxcount = max_channel_led_count(ws2811);
-    int bitpos = 31;
+    ws2811_device_t *device = ws2811->device;
+    uint64_t start = monotonic_ns();
+    int ret;
+
+    if (dma_status(ws2811) > 0)
+    {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &device->dma_deadline,
+                               NULL) == EINTR)
+            ;
+
+        while (dma_status(ws2811) > 0)
+        {
+            usleep(DMA_POLL_uS);
+        }
+    }
+
+    ret = ws2811_try_wait(ws2811);
+    stats_record(&device->stats.wait, monotonic_ns() - start);
+
+    return ret;
+}
+
+/**
+ * Check for DMA completion without blocking.  Meant to be called when the fd from
+ * ws2811_get_fd() is readable.  If the frame is still running the fd is re-armed to
+ * fire again shortly, otherwise it is cleared.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 if complete, 1 if still in progress, -1 on DMA completion error.
+ */
+int ws2811_try_wait(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    uint64_t expirations;
+    int ret;
+
+    // Consume any pending expiration so the fd stops being readable
+    if (device->timer_fd_used &&
+        (read(device->timer_fd, &expirations, sizeof(expirations)) < 0))
+    {
+        expirations = 0;
+    }
+
+    ret = dma_status(ws2811);
+    if (ret < 0)
+    {
+        device->stats.dma_errors++;
+        device->stats.dma_last_debug = device->dma->debug;
+        fprintf(stderr, "DMA Error: %08x\n", device->stats.dma_last_debug);
+    }
+    else if (ret > 0)
+    {
+        struct timespec retry;
+
+        clock_gettime(CLOCK_MONOTONIC, &retry);
+        timespec_add_ns(&retry, DMA_POLL_uS * 1000);
+        timer_fd_arm(ws2811, &retry);
+    }
+
+    if ((ret <= 0) && device->dma_pending)
+    {
+        device->dma_pending = 0;
+        stats_record(&device->stats.dma, monotonic_ns() - device->dma_started_ns);
+    }
+
+    return ret;
+}
+
+/**
+ * Get a file descriptor that becomes readable when the DMA for the last rendered frame
+ * is expected to be complete, for use with poll(), select() or epoll.  Call
+ * ws2811_try_wait() when it is readable.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  File descriptor, owned by the library.
+ */
+int ws2811_get_fd(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+
+    if (!device->timer_fd_used)
+    {
+        device->timer_fd_used = 1;
+
+        // Catch up with a frame started before anyone was listening
+        if (device->dma_pending)
+        {
+            timer_fd_arm(ws2811, &device->dma_deadline);
+        }
+    }
+
+    return device->timer_fd;
+}
+
+/**
+ * Check whether the color and symbol tables of a channel were built for its current
+ * settings.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ *
+ * @returns  1 if the tables need rebuilding, 0 otherwise.
+ */
+static int symbol_table_stale(ws2811_t *ws2811, int chan)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+
+    return (device->table_brightness[chan] != channel->brightness) ||
+           (device->table_invert[chan] != channel->invert) ||
+           (device->table_gamma[chan] != channel->gamma) ||
+           (device->table_white_balance[chan] != channel->white_balance);
+}
+
+/**
+ * Build the color lookup table for a channel: gamma curve, then white balance gain,
+ * then brightness, for each of green, red and blue.  With no gamma or white balance
+ * set this is the plain brightness scaling.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ *
+ * @returns  None
+ */
+static void color_lut_build(ws2811_t *ws2811, int chan)
+{
+    static const int shift[COLOR_COUNT] = { 8, 16, 0 };  // Green, red, blue
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+    uint32_t white_balance = channel->white_balance ? channel->white_balance : 0xffffff;
+    int linear = (channel->gamma <= 0.0f) || (channel->gamma == 1.0f);
+    int scale = (channel->brightness & 0xff) + 1;
+    int i, j;
+
+    for (j = 0; j < COLOR_COUNT; j++)
+    {
+        uint8_t *lut = ws2811->device->color_lut[chan][j];
+        int gain = ((white_balance >> shift[j]) & 0xff) + 1;
+
+        for (i = 0; i < SYMBOL_TABLE_SIZE; i++)
+        {
+            int color = i;
+
+            if (!linear)
+            {
+                color = (int)((powf(i / 255.0f, channel->gamma) * 255.0f) + 0.5f);
+            }
+
+            color = (color * gain) >> 8;
+            lut[i] = (color * scale) >> 8;
+        }
+    }
+}
+
+/**
+ * Build the color lookup table and symbol tables for a channel.  Each symbol table
+ * entry maps a color byte to the PWM symbol bits (8 data bits * timing.symbols) it
+ * expands to, right justified, with the color lookup table and output inversion
+ * already applied.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ *
+ * @returns  None
+ */
+static void symbol_table_build(ws2811_t *ws2811, int chan)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+    const timing_t *timing = &device->timing;
+    uint32_t mask = 0xffffffff >> (32 - LED_SYMBOL_COUNT(timing) / 3);
+    uint32_t high = timing_symbols(timing, 1);
+    uint32_t low = timing_symbols(timing, 0);
+    int i, j, k;
+
+    color_lut_build(ws2811, chan);
+
+    for (j = 0; j < COLOR_COUNT; j++)
+    {
+        const uint8_t *lut = device->color_lut[chan][j];
+        uint32_t *table = device->symbol_table[chan][j];
+
+        for (i = 0; i < SYMBOL_TABLE_SIZE; i++)
+        {
+            uint8_t color = lut[i];
+            uint32_t symbols = 0;
+
+            for (k = 7; k >= 0; k--)
+            {
+                symbols <<= timing->symbols;
+                symbols |= (color & (1 << k)) ? high : low;
+            }
+
+            if (channel->invert)
+            {
+                symbols = ~symbols & mask;
+            }
+
+            table[i] = symbols;
+        }
+    }
+
+    device->table_brightness[chan] = channel->brightness;
+    device->table_invert[chan] = channel->invert;
+    device->table_gamma[chan] = channel->gamma;
+    device->table_white_balance[chan] = channel->white_balance;
+}
+
+/**
+ * Reference encoder.  Builds the PWM DMA buffer one symbol bit at a time.  Slow, but
+ * kept as the definition of correct output for the faster encoders.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void render_reference(ws2811_t *ws2811)
+{
+    volatile uint8_t *pwm_raw = ws2811->device->buf->pwm_raw;
+    const timing_t *timing = &ws2811->device->timing;
     int i, j, k, l, chan;
 
     for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)         // Channel
     {
         ws2811_channel_t *channel = &ws2811->channel[chan];
+        uint8_t (*lut)[SYMBOL_TABLE_SIZE] = ws2811->device->color_lut[chan];
         int wordpos = chan;
-        int scale   = (channel->brightness & 0xff) + 1;
+        int bitpos = 31;
 
         for (i = 0; i < channel->count; i++)                // Led
         {
             uint8_t color[] =
             {
-                (((channel->leds[i] >> 8)  & 0xff) * scale) >> 8, // green
-                (((channel->leds[i] >> 16) & 0xff) * scale) >> 8, // red
-                (((channel->leds[i] >> 0)  & 0xff) * scale) >> 8, // blue
+                lut[0][(channel->leds[i] >> 8)  & 0xff],    // green
+                lut[1][(channel->leds[i] >> 16) & 0xff],    // red
+                lut[2][(channel->leds[i] >> 0)  & 0xff],    // blue
             };
 
             for (j = 0; j < ARRAY_SIZE(color); j++)        // Color
             {
                 for (k = 7; k >= 0; k--)                   // Bit
                 {
-                    uint8_t symbol = SYMBOL_LOW;
-
-                    if (color[j] & (1 << k))
-                    {
-                        symbol = SYMBOL_HIGH;
-                    }
+                    uint8_t symbol = timing_symbols(timing, color[j] & (1 << k));
 
                     if (channel->invert)
                     {
-                        symbol = ~symbol & 0x7;
+                        symbol = ~symbol & ((1 << timing->symbols) - 1);
                     }
 
-                    for (l = 2; l >= 0; l--)               // Symbol
+                    for (l = timing->symbols - 1; l >= 0; l--)  // Symbol
                     {
                         uint32_t *wordptr = &((uint32_t *)pwm_raw)[wordpos];
 
@@ -740,10 +1240,367 @@ int ws2811_render(ws2811_t *ws2811)
             }
         }
     }
+}
+
+/**
+ * Table driven encoder for a range of LEDs on a single channel.  Each color byte is
+ * looked up in the channel symbol table and shifted into an accumulator, which is
+ * stored to the DMA buffer a whole word at a time.  Words shared with LEDs outside of
+ * the range are merged so neighbouring symbols are left untouched.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ * @param    first   First LED to encode.
+ * @param    last    One past the last LED to encode.
+ *
+ * @returns  None
+ */
+static void encode_range(ws2811_t *ws2811, int chan, int first, int last)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+    uint32_t (*table)[SYMBOL_TABLE_SIZE] = device->symbol_table[chan];
+    int table_bits = LED_SYMBOL_COUNT(&device->timing) / COLOR_COUNT;
+    uint32_t bitpos = first * LED_SYMBOL_COUNT(&device->timing);
+    uint32_t *wordptr = &((uint32_t *)device->buf->pwm_raw)[chan];
+    uint64_t acc = 0;
+    int accbits = bitpos & 31;
+    int i, j;
+
+    // Every other word is on the same channel
+    wordptr += (bitpos >> 5) * RPI_PWM_CHANNELS;
+
+    // Pick up the symbols of the previous LED sharing the first word
+    if (accbits)
+    {
+        acc = *wordptr >> (32 - accbits);
+    }
+
+    for (i = first; i < last; i++)
+    {
+        ws2811_led_t led = channel->leds[i];
+        uint8_t color[] =
+        {
+            (led >> 8)  & 0xff,                              // green
+            (led >> 16) & 0xff,                              // red
+            (led >> 0)  & 0xff,                              // blue
+        };
+
+        for (j = 0; j < ARRAY_SIZE(color); j++)
+        {
+            acc = (acc << table_bits) | table[j][color[j]];
+            accbits += table_bits;
+
+            if (accbits >= 32)
+            {
+                accbits -= 32;
+                *wordptr = acc >> accbits;
+                wordptr += RPI_PWM_CHANNELS;
+            }
+        }
+    }
+
+    // Merge the leftover symbols into the final word, keeping the next LED or idle bits
+    if (accbits)
+    {
+        *wordptr = (*wordptr & (0xffffffff >> accbits)) |
+                   (uint32_t)(acc << (32 - accbits));
+    }
+}
+
+/**
+ * Count the LEDs on a channel that differ from what is currently encoded in a
+ * DMA buffer.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    buf     Buffer to compare against.
+ * @param    chan    Channel number.
+ *
+ * @returns  Number of LEDs that need to be encoded.
+ */
+static int channel_dirty_count(ws2811_t *ws2811, ws2811_buffer_t *buf, int chan)
+{
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+    const ws2811_led_t *shadow = buf->shadow[chan];
+    int i, dirty = 0;
+
+    if (!buf->shadow_valid[chan])
+    {
+        return channel->count;
+    }
+
+    for (i = 0; i < channel->count; i++)
+    {
+        if (channel->leds[i] != shadow[i])
+        {
+            dirty++;
+        }
+    }
+
+    return dirty;
+}
+
+/**
+ * Mark the whole channel as encoded, after a full channel encode.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ *
+ * @returns  None
+ */
+static void channel_shadow_update(ws2811_t *ws2811, int chan)
+{
+    ws2811_buffer_t *buf = ws2811->device->buf;
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+
+    memcpy(buf->shadow[chan], channel->leds, sizeof(ws2811_led_t) * channel->count);
+    buf->shadow_valid[chan] = 1;
+}
+
+/**
+ * Encode only the runs of LEDs on a channel that changed since the last render.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ *
+ * @returns  Number of LEDs encoded.
+ */
+static int encode_dirty(ws2811_t *ws2811, int chan)
+{
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+    ws2811_led_t *shadow = ws2811->device->buf->shadow[chan];
+    int i = 0, encoded = 0;
+
+    while (i < channel->count)
+    {
+        int first;
+
+        if (channel->leds[i] == shadow[i])
+        {
+            i++;
+            continue;
+        }
+
+        first = i;
+        while ((i < channel->count) && (channel->leds[i] != shadow[i]))
+        {
+            i++;
+        }
+
+        encode_range(ws2811, chan, first, i);
+        memcpy(&shadow[first], &channel->leds[first], sizeof(ws2811_led_t) * (i - first));
+        encoded += i - first;
+    }
+
+    return encoded;
+}
+
+/**
+ * Vector encoder.  When both channels are in use, the LEDs they have in common are
+ * expanded together in a single pass over the DMA buffer, writing the interleaved FIFO
+ * words in order.  Whatever is left over on either channel is finished off by the table
+ * encoder, as is everything when only one channel is used, the timing profile uses
+ * another symbol encoding or no vector unit is available.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void render_simd(ws2811_t *ws2811)
+{
+    ws2811_channel_t *channel = ws2811->channel;
+    const timing_t *timing = &ws2811->device->timing;
+    int common = channel[0].count < channel[1].count ? channel[0].count : channel[1].count;
+    int groups = 0;
+    int chan;
+
+    // The vector encoder only generates the 3 symbol 1 1 0 / 1 0 0 encoding
+    if ((common >= SIMD_GROUP_LEDS) &&
+        (timing->symbols == 3) && (timing->t0h == 1) && (timing->t1h == 2))
+    {
+        const uint8_t *lut[] =
+        {
+            &ws2811->device->color_lut[0][0][0],
+            &ws2811->device->color_lut[1][0][0],
+        };
+        int invert[] =
+        {
+            channel[0].invert,
+            channel[1].invert,
+        };
+
+        groups = simd_encode_dual((uint32_t *)ws2811->device->buf->pwm_raw,
+                                  channel[0].leds, channel[1].leds,
+                                  common / SIMD_GROUP_LEDS, lut, invert);
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        encode_range(ws2811, chan, groups * SIMD_GROUP_LEDS, channel[chan].count);
+    }
+}
+
+/**
+ * Incremental encoder.  Only LEDs that changed since the last render, or every LED
+ * after a brightness or inversion change, are encoded.  When most of both channels
+ * changed the whole buffer is rebuilt with the vector encoder instead.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    dirty   Number of changed LEDs on each channel.
+ *
+ * @returns  Number of LEDs encoded.
+ */
+static int render_incremental(ws2811_t *ws2811, const int *dirty)
+{
+    ws2811_channel_t *channel = ws2811->channel;
+    int encoded = 0;
+    int chan;
+
+    if ((ws2811->encoder != WS2811_ENCODER_TABLE) &&
+        ((dirty[0] * 2) > channel[0].count) &&
+        ((dirty[1] * 2) > channel[1].count))
+    {
+        render_simd(ws2811);
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            channel_shadow_update(ws2811, chan);
+            encoded += channel[chan].count;
+        }
+
+        return encoded;
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (dirty[chan] == channel[chan].count)
+        {
+            encode_range(ws2811, chan, 0, channel[chan].count);
+            channel_shadow_update(ws2811, chan);
+            encoded += channel[chan].count;
+        }
+        else if (dirty[chan])
+        {
+            encoded += encode_dirty(ws2811, chan);
+        }
+    }
+
+    return encoded;
+}
+
+/**
+ * Check whether the LEDs already show the current LED arrays, i.e. they match what was
+ * encoded into the buffer most recently handed to the DMA.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  1 if nothing changed since the last frame, 0 otherwise.
+ */
+static int frame_unchanged(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int chan;
+
+    if (device->dma_buf < 0)
+    {
+        return 0;
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (channel_dirty_count(ws2811, &device->buffer[device->dma_buf], chan))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Render the PWM DMA buffer from the user supplied LED arrays and start the DMA
+ * controller.  This will update all LEDs on both PWM channels.  Only LEDs that changed
+ * since the previous render are encoded, and if nothing changed at all the DMA is not
+ * started.  The number of LEDs encoded is left in ws2811->encoded.
+ *
+ * With more than one buffer, the frame is encoded into a buffer the DMA is not reading
+ * while the previous frame is still streaming out, and only the start of the DMA waits
+ * for the previous frame to complete.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA error.
+ */
+int ws2811_render(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int maxcount = max_channel_led_count(ws2811);
+    int dirty[RPI_PWM_CHANNELS];
+    volatile uint8_t *pwm_raw;
+    rt_usage_t usage, usage_end;
+    uint64_t start;
+    int chan, i;
+
+    // The real-time self check costs two system calls, so it comes with the stats
+    if (ws2811->rt_priority && ws2811->stats_interval)
+    {
+        rt_usage_sample(&usage);
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        // A new symbol table invalidates everything encoded with the old one
+        if (symbol_table_stale(ws2811, chan))
+        {
+            symbol_table_build(ws2811, chan);
+
+            for (i = 0; i < device->buffer_count; i++)
+            {
+                device->buffer[i].shadow_valid[chan] = 0;
+            }
+        }
+    }
+
+    // The LEDs already show this frame
+    ws2811->encoded = 0;
+    if (frame_unchanged(ws2811))
+    {
+        device->stats.frames_skipped++;
+        stats_dump(ws2811);
+        return 0;
+    }
+
+    start = monotonic_ns();
+
+    // Encode into the buffer after the one the DMA was last started on
+    device->buf = &device->buffer[(device->dma_buf + 1) % device->buffer_count];
+    pwm_raw = device->buf->pwm_raw;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        dirty[chan] = channel_dirty_count(ws2811, device->buf, chan);
+    }
+
+    if (ws2811->encoder == WS2811_ENCODER_REFERENCE)
+    {
+        render_reference(ws2811);
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            channel_shadow_update(ws2811, chan);
+            ws2811->encoded += ws2811->channel[chan].count;
+        }
+    }
+    else
+    {
+        ws2811->encoded = render_incremental(ws2811, dirty);
+    }
 
     // Ensure the CPU data cache is flushed before the DMA is started.
     __clear_cache((char *)pwm_raw,
-                  (char *)&pwm_raw[PWM_BYTE_COUNT(maxcount, ws2811->freq)]);
+                  (char *)&pwm_raw[timing_byte_count(&device->timing, maxcount)]);
+
+    stats_record(&device->stats.encode, monotonic_ns() - start);
 
     // Wait for any previous DMA operation to complete.
     if (ws2811_wait(ws2811))
@@ -753,6 +1610,113 @@ int ws2811_render(ws2811_t *ws2811)
 
     dma_start(ws2811);
 
+    if (ws2811->rt_priority && ws2811->stats_interval)
+    {
+        rt_usage_sample(&usage_end);
+        device->stats.rt_page_faults += usage_end.faults - usage.faults;
+        device->stats.rt_involuntary_switches += usage_end.involuntary - usage.involuntary;
+    }
+
+    stats_dump(ws2811);
+
+    return 0;
+}
+
+/**
+ * Get a copy of the runtime statistics: frame counts, DMA errors and histograms of
+ * the encode, wait and DMA times.  Only frames_dropped is kept atomically, the rest is
+ * written by the rendering thread, so don't call this while a driver thread is running.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    stats   Filled in with the statistics.
+ *
+ * @returns  None
+ */
+void ws2811_get_stats(ws2811_t *ws2811, ws2811_stats_t *stats)
+{
+    *stats = ws2811->device->stats;
+    stats->frames_dropped = __atomic_load_n(&ws2811->device->stats.frames_dropped,
+                                            __ATOMIC_RELAXED);
+}
+
+/**
+ * Count a frame lost to the submission queue overflow policy.  Called on the submitting
+ * thread while the driver thread may be reading the stats.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+void stats_frame_dropped(ws2811_t *ws2811)
+{
+    __atomic_fetch_add(&ws2811->device->stats.frames_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Make the calling thread the real-time render thread: SCHED_FIFO at .rt_priority,
+ * pinned to .rt_cpus.  Nothing to do outside real-time mode.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int render_thread_claim(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+
+    if (!ws2811->rt_priority)
+    {
+        return 0;
+    }
+
+    if (rt_thread_setup(ws2811->rt_priority, ws2811->rt_cpus))
+    {
+        // Affinity may have been applied before the policy failed
+        rt_thread_restore(&device->rt_caller);
+        return -1;
+    }
+
+    device->rt_caller_active = 1;
+
     return 0;
 }
 
+/**
+ * Give the calling thread back the scheduling it had before ws2811_init(), so that
+ * only the driver thread runs real-time while it renders.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+void render_thread_release(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+
+    if (device->rt_caller_active)
+    {
+        rt_thread_restore(&device->rt_caller);
+        device->rt_caller_active = 0;
+    }
+}
+
+/**
+ * Get the words the simulated PWM FIFO received for the last completed frame, for
+ * checking encoder and DMA chain output off target.  Call after ws2811_wait().
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    count   Returns the number of words.
+ *
+ * @returns  Pointer to the captured words, NULL if not using the simulator backend.
+ */
+const uint32_t *ws2811_sim_fifo(ws2811_t *ws2811, uint32_t *count)
+{
+    if ((ws2811->backend != WS2811_BACKEND_SIM) &&
+        (ws2811->backend != WS2811_BACKEND_SIM_UNPACED))
+    {
+        *count = 0;
+        return NULL;
+    }
+
+    return sim_fifo_capture(ws2811->device->backend, count);
+}
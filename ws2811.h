@@ -37,7 +37,36 @@
 
 #define WS2811_TARGET_FREQ                       800000   // Can go as low as 400000
 
+#define WS2811_BACKEND_HW                        0        // /dev/mem and pagemap, needs root
+#define WS2811_BACKEND_SIM                       1        // Simulated registers and DMA
+#define WS2811_BACKEND_SIM_UNPACED               2        // As above, without wire timing
+
+#define WS2811_MAX_BUFFERS                       4        // DMA buffers for ws2811_t.buffers
+
+#define WS2811_ENCODER_DEFAULT                   0        // Fastest available encoder
+#define WS2811_ENCODER_TABLE                     1        // Table driven, word at a time
+#define WS2811_ENCODER_REFERENCE                 2        // Original bit at a time loop
+#define WS2811_ENCODER_SIMD                      3        // NEON/SSE2, both channels at once
+
+#define WS2811_TIMING_DEFAULT                    0        // 3 symbols per bit at .freq, 55uS reset
+#define WS2811_TIMING_WS2811_400K                1        // WS2811 in slow mode
+#define WS2811_TIMING_WS2812B                    2
+#define WS2811_TIMING_SK6812                     3
+#define WS2811_TIMING_WS2813                     4
+
+#define WS2811_QUEUE_MAILBOX                     0        // Latest frame wins, never blocks
+#define WS2811_QUEUE_DROP_OLDEST                 1        // Ring, a full ring loses its oldest frame
+#define WS2811_QUEUE_DROP_NEWEST                 2        // Ring, a full ring refuses the new frame
+#define WS2811_QUEUE_BLOCK                       3        // Ring, submitting waits for space
+#define WS2811_QUEUE_MAX_DEPTH                   16       // Frames in the ring
+
+#define WS2811_STATS_BUCKETS                     32       // Histogram buckets, log2 of ns
+
+#define WS2811_PARALLEL_MAX_LANES                24       // Strings driven by the GPIO engine
+
 struct ws2811_device;
+struct ws2811_driver;
+struct ws2811_parallel_device;
 
 typedef uint32_t ws2811_led_t;                   //< 0x00RRGGBB
 typedef struct
@@ -46,22 +75,90 @@ typedef struct
     int invert;                                  //< Invert output signal
     int count;                                   //< Number of LEDs, 0 if channel is unused
     int brightness;                              //< Brightness value between 0 and 255
+    float gamma;                                 //< Gamma correction exponent, 0 or 1 for none
+    uint32_t white_balance;                      //< Gain of each primary as 0x00RRGGBB, 0 for none
     ws2811_led_t *leds;                          //< LED buffers, allocated by driver based on count
 } ws2811_channel_t;
 
+typedef struct
+{
+    uint64_t count;                              //< Samples recorded
+    uint64_t total_ns;                           //< Sum of all samples
+    uint64_t max_ns;                             //< Largest sample
+    uint64_t bucket[WS2811_STATS_BUCKETS];       //< Samples of 2^i up to 2^(i+1) ns, last is open
+} ws2811_histogram_t;
+
+typedef struct
+{
+    uint64_t frames_rendered;                    //< Frames handed to the DMA
+    uint64_t frames_skipped;                     //< Renders where no LED had changed
+    uint64_t frames_dropped;                     //< Submitted frames lost to the queue policy
+    uint64_t dma_errors;                         //< DMA completion errors
+    uint32_t dma_last_debug;                     //< DMA debug register at the last error
+    uint64_t init_ns;                            //< Time ws2811_init() took
+    uint32_t dma_cb_count;                       //< Control blocks in the longest DMA chain
+    uint32_t dma_huge_buffers;                   //< DMA buffers that are in huge pages
+    uint64_t rt_page_faults;                     //< Page faults in ws2811_render(), real-time mode
+    uint64_t rt_involuntary_switches;            //< Preemptions in ws2811_render(), real-time mode
+    ws2811_histogram_t encode;                   //< Encoding a frame into the DMA buffer
+    ws2811_histogram_t wait;                     //< Time spent in ws2811_wait()
+    ws2811_histogram_t dma;                      //< DMA start until completion was seen
+} ws2811_stats_t;
+
 typedef struct
 {
     struct ws2811_device *device;                //< Private data for driver use
+    struct ws2811_driver *driver;                //< Private data for the driver thread
     uint32_t freq;                               //< Required output frequency
     int dmanum;                                  //< DMA number _not_ already in use
+    int backend;                                 //< WS2811_BACKEND_*, 0 for the hardware
+    int encoder;                                 //< WS2811_ENCODER_*, 0 for default
+    int encoded;                                 //< LEDs encoded by the last ws2811_render()
+    int buffers;                                 //< DMA buffers to rotate through, 0 or 1 for one
+    int hugepages;                               //< Put DMA buffers in huge pages if any are free
+    int stats_interval;                          //< Seconds between stats dumps to stderr, 0 for none
+    int timing;                                  //< WS2811_TIMING_*, profiles other than 0 set .freq
+    int rt_priority;                             //< SCHED_FIFO priority of the rendering thread, 0 for none
+    uint32_t rt_cpus;                            //< CPUs to pin the rendering thread to, 0 for any
     ws2811_channel_t channel[RPI_PWM_CHANNELS];
 } ws2811_t;
 
+/*
+ * Parallel GPIO engine.  Drives up to WS2811_PARALLEL_MAX_LANES strings in lockstep from
+ * GPIO bank 0 instead of the two PWM channels.  The PWM is only used to pace the DMA.
+ */
+typedef struct
+{
+    struct ws2811_parallel_device *device;       //< Private data for driver use
+    uint32_t freq;                               //< Required output frequency
+    int dmanum;                                  //< DMA number _not_ already in use
+    int backend;                                 //< WS2811_BACKEND_*, 0 for the hardware
+    int lanes;                                   //< Number of strings, 1 to WS2811_PARALLEL_MAX_LANES
+    int count;                                   //< LEDs in each string
+    int brightness;                              //< Brightness value between 0 and 255
+    int gpionum[WS2811_PARALLEL_MAX_LANES];      //< GPIO pin of each string, 0 to 31
+    ws2811_led_t *leds;                          //< lanes * count LEDs, one string after another
+} ws2811_parallel_t;
+
 
 int ws2811_init(ws2811_t *ws2811);               //< Initialize buffers/hardware
 void ws2811_fini(ws2811_t *ws2811);              //< Tear it all down
 int ws2811_render(ws2811_t *ws2811);             //< Send LEDs off to hardware
 int ws2811_wait(ws2811_t *ws2811);               //< Wait for DMA completion
+int ws2811_try_wait(ws2811_t *ws2811);           //< Check DMA completion, 1 if still busy
+int ws2811_get_fd(ws2811_t *ws2811);             //< Readable when DMA should be complete
+void ws2811_get_stats(ws2811_t *ws2811, ws2811_stats_t *stats);  //< Copy the runtime statistics, not while a driver runs
+const uint32_t *ws2811_sim_fifo(ws2811_t *ws2811, uint32_t *count);  //< Simulated FIFO output
+
+int ws2811_driver_start(ws2811_t *ws2811, int policy, int depth);  //< Render from a library thread
+void ws2811_driver_stop(ws2811_t *ws2811);       //< Stop the driver thread
+int ws2811_submit(ws2811_t *ws2811, ws2811_led_t *const leds[RPI_PWM_CHANNELS]);  //< Queue a frame
+
+int ws2811_parallel_init(ws2811_parallel_t *parallel);     //< Initialize the GPIO engine
+void ws2811_parallel_fini(ws2811_parallel_t *parallel);    //< Tear it all down
+int ws2811_parallel_render(ws2811_parallel_t *parallel);   //< Send LEDs off to hardware
+int ws2811_parallel_wait(ws2811_parallel_t *parallel);     //< Wait for DMA completion
+const uint32_t *ws2811_parallel_sim_gpio(ws2811_parallel_t *parallel, uint32_t *count);  //< Simulated levels
 
 
 #endif /* __WS2811_H__ */
@@ -0,0 +1,510 @@
+/*
+ * ws2811.hpp
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+
+#ifndef __WS2811_HPP__
+#define __WS2811_HPP__
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+extern "C"
+{
+#include "ws2811.h"
+}
+
+
+/*
+ * Header only C++ layer over ws2811_t.
+ *
+ * The library always sends 24 bits per LED, taking the bytes of each ws2811_led_t in the order
+ * green, red, blue.  Each strip type below describes the order the LEDs on the wire expect and
+ * whether they have a white component.  Pixels are packed straight into the library's LED
+ * buffer in that order with shifts that are known at compile time, so the encoder needs no
+ * per strip handling.  Strips with a white component are sent as a byte stream, every three
+ * LEDs taking four ws2811_led_t.  Brightness and gamma still come from the channel's color
+ * tables, white_balance must be left at 0 for those strips as bytes no longer line up with a
+ * primary.
+ */
+namespace ws2811
+{
+
+enum class order
+{
+    rgb,
+    rbg,
+    grb,
+    gbr,
+    brg,
+    bgr,
+};
+
+struct rgb
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+struct rgbw
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t w;
+};
+
+namespace detail
+{
+
+// Shift of each wire byte within a ws2811_led_t, in the order the library sends them
+constexpr std::array<unsigned, 3> wire_shift = { 8, 16, 0 };
+
+// Position of red, green and blue on the wire
+constexpr std::array<unsigned, 3> wire_position(order o)
+{
+    switch (o)
+    {
+        case order::rgb: return { 0, 1, 2 };
+        case order::rbg: return { 0, 2, 1 };
+        case order::grb: return { 1, 0, 2 };
+        case order::gbr: return { 2, 0, 1 };
+        case order::brg: return { 1, 2, 0 };
+        case order::bgr: return { 2, 1, 0 };
+    }
+
+    return { 0, 1, 2 };
+}
+
+} // namespace detail
+
+/**
+ * Description of a strip type.
+ *
+ * @param    Order   Order of the primaries on the wire.
+ * @param    White   LEDs have a fourth, white, byte sent last.
+ * @param    Invert  Output goes through an inverting level shifter.
+ */
+template <order Order, bool White = false, bool Invert = false>
+struct strip
+{
+    using pixel = std::conditional_t<White, rgbw, rgb>;
+
+    static constexpr order color_order = Order;
+    static constexpr bool white = White;
+    static constexpr bool invert = Invert;
+    static constexpr unsigned bytes = White ? 4 : 3;
+
+    static constexpr std::array<unsigned, 3> position = detail::wire_position(Order);
+    static constexpr unsigned red_shift = detail::wire_shift[position[0]];
+    static constexpr unsigned green_shift = detail::wire_shift[position[1]];
+    static constexpr unsigned blue_shift = detail::wire_shift[position[2]];
+
+    /**
+     * Number of ws2811_led_t the library has to send for a strip.
+     *
+     * @param    count  LEDs on the strip.
+     *
+     * @returns  Library LED count.
+     */
+    static constexpr int library_count(int count)
+    {
+        return White ? (count * 4 + 2) / 3 : count;
+    }
+
+    /**
+     * Pack the primaries of a pixel into a library LED.
+     *
+     * @param    p  Pixel.
+     *
+     * @returns  LED value that comes out in the wire order of this strip.
+     */
+    static constexpr ws2811_led_t pack(const rgb &p)
+    {
+        return ((ws2811_led_t)p.r << red_shift) |
+               ((ws2811_led_t)p.g << green_shift) |
+               ((ws2811_led_t)p.b << blue_shift);
+    }
+
+    /**
+     * Write the bytes of a pixel in wire order.
+     *
+     * @param    p     Pixel.
+     * @param    wire  Destination, bytes long.
+     *
+     * @returns  None
+     */
+    static constexpr void to_wire(const pixel &p, uint8_t *wire)
+    {
+        wire[position[0]] = p.r;
+        wire[position[1]] = p.g;
+        wire[position[2]] = p.b;
+        if constexpr (White)
+        {
+            wire[3] = p.w;
+        }
+    }
+};
+
+using ws2811_rgb = strip<order::rgb>;
+using ws2812b = strip<order::grb>;
+using sk6812 = strip<order::grb>;
+using sk6812_rgbw = strip<order::grb, true>;
+using ws2815 = strip<order::grb>;
+
+
+/**
+ * Typed view of one channel's LED buffer.
+ */
+template <typename Strip>
+class channel
+{
+public:
+    using pixel = typename Strip::pixel;
+
+    channel(ws2811_channel_t &chan, int count) : chan_(chan), count_(count)
+    {
+    }
+
+    /**
+     * @returns  LEDs on the strip.
+     */
+    size_t size() const
+    {
+        return count_;
+    }
+
+    int brightness() const
+    {
+        return chan_.brightness;
+    }
+
+    /**
+     * Set the brightness, applied through the channel's color tables.
+     *
+     * @param    value  0 to 255.
+     *
+     * @returns  None
+     */
+    void brightness(int value)
+    {
+        chan_.brightness = value;
+    }
+
+    /**
+     * Set one LED.  On strips with a white byte this has to merge with the neighbouring LEDs,
+     * write() is the faster way to change a run of them.
+     *
+     * @param    index  LED index.
+     * @param    p      Pixel.
+     *
+     * @returns  None
+     */
+    void set(size_t index, const pixel &p)
+    {
+        if constexpr (Strip::white)
+        {
+            uint8_t wire[Strip::bytes];
+            size_t i;
+
+            Strip::to_wire(p, wire);
+            for (i = 0; i < Strip::bytes; i++)
+            {
+                put_byte(index * Strip::bytes + i, wire[i]);
+            }
+        }
+        else
+        {
+            chan_.leds[index] = Strip::pack(p);
+        }
+    }
+
+    /**
+     * Copy pixels onto the strip, starting at the first LED.
+     *
+     * @param    pixels  Up to size() pixels.
+     *
+     * @returns  None
+     */
+    void write(std::span<const pixel> pixels)
+    {
+        ws2811_led_t *leds = chan_.leds;
+        size_t count = pixels.size() < count_ ? pixels.size() : count_;
+        size_t i;
+
+        if constexpr (Strip::white)
+        {
+            // Three pixels fill exactly four library LEDs
+            for (i = 0; i + 3 <= count; i += 3)
+            {
+                uint8_t wire[12];
+
+                Strip::to_wire(pixels[i], &wire[0]);
+                Strip::to_wire(pixels[i + 1], &wire[4]);
+                Strip::to_wire(pixels[i + 2], &wire[8]);
+
+                *leds++ = pack_wire(&wire[0]);
+                *leds++ = pack_wire(&wire[3]);
+                *leds++ = pack_wire(&wire[6]);
+                *leds++ = pack_wire(&wire[9]);
+            }
+
+            for (; i < count; i++)
+            {
+                set(i, pixels[i]);
+            }
+        }
+        else
+        {
+            for (i = 0; i < count; i++)
+            {
+                leds[i] = Strip::pack(pixels[i]);
+            }
+        }
+    }
+
+    /**
+     * Set every LED to the same pixel.
+     *
+     * @param    p  Pixel.
+     *
+     * @returns  None
+     */
+    void fill(const pixel &p)
+    {
+        size_t i;
+
+        if constexpr (Strip::white)
+        {
+            ws2811_led_t block[4];
+            uint8_t wire[12];
+            size_t full = count_ / 3 * 4;
+
+            Strip::to_wire(p, &wire[0]);
+            Strip::to_wire(p, &wire[4]);
+            Strip::to_wire(p, &wire[8]);
+            for (i = 0; i < 4; i++)
+            {
+                block[i] = pack_wire(&wire[i * 3]);
+            }
+
+            for (i = 0; i < full; i++)
+            {
+                chan_.leds[i] = block[i % 4];
+            }
+
+            for (i = count_ / 3 * 3; i < count_; i++)
+            {
+                set(i, p);
+            }
+        }
+        else
+        {
+            ws2811_led_t led = Strip::pack(p);
+
+            for (i = 0; i < count_; i++)
+            {
+                chan_.leds[i] = led;
+            }
+        }
+    }
+
+    ws2811_channel_t &native()
+    {
+        return chan_;
+    }
+
+private:
+    static constexpr ws2811_led_t pack_wire(const uint8_t *wire)
+    {
+        return ((ws2811_led_t)wire[0] << detail::wire_shift[0]) |
+               ((ws2811_led_t)wire[1] << detail::wire_shift[1]) |
+               ((ws2811_led_t)wire[2] << detail::wire_shift[2]);
+    }
+
+    void put_byte(size_t offset, uint8_t value)
+    {
+        ws2811_led_t *led = &chan_.leds[offset / 3];
+        unsigned shift = detail::wire_shift[offset % 3];
+
+        *led = (*led & ~((ws2811_led_t)0xff << shift)) | ((ws2811_led_t)value << shift);
+    }
+
+    ws2811_channel_t &chan_;
+    size_t count_;
+};
+
+
+/**
+ * Settings for one channel, the strip type is given to the controller.
+ */
+struct channel_config
+{
+    int gpionum = 0;                             //< GPIO Pin with PWM alternate function, 0 if unused
+    int count = 0;                               //< LEDs on the strip, 0 if channel is unused
+    int brightness = 255;                        //< Brightness value between 0 and 255
+    float gamma = 0;                             //< Gamma correction exponent, 0 or 1 for none
+    uint32_t white_balance = 0;                  //< Gain of each primary, strips without white only
+};
+
+/**
+ * Move only owner of an initialized ws2811_t.  Construction calls ws2811_init() and throws
+ * std::runtime_error if that fails, destruction calls ws2811_fini().  The remaining calls
+ * return what the library returns.
+ */
+template <typename Strip0, typename Strip1 = ws2812b>
+class controller
+{
+public:
+    /**
+     * @param    base   Driver settings, the channels are filled in from ch0 and ch1.
+     * @param    ch0    First channel.
+     * @param    ch1    Second channel.
+     */
+    controller(const ws2811_t &base, const channel_config &ch0,
+               const channel_config &ch1 = channel_config())
+        : ws2811_(new ws2811_t(base)), count_{ ch0.count, ch1.count }
+    {
+        setup<Strip0>(ws2811_->channel[0], ch0);
+        setup<Strip1>(ws2811_->channel[1], ch1);
+
+        if (ws2811_init(ws2811_.get()))
+        {
+            ws2811_.reset();
+            throw std::runtime_error("ws2811_init failed");
+        }
+    }
+
+    ~controller()
+    {
+        if (ws2811_)
+        {
+            ws2811_fini(ws2811_.get());
+        }
+    }
+
+    controller(controller &&other) noexcept = default;
+
+    controller &operator=(controller &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (ws2811_)
+            {
+                ws2811_fini(ws2811_.get());
+            }
+            ws2811_ = std::move(other.ws2811_);
+            count_ = other.count_;
+        }
+
+        return *this;
+    }
+
+    controller(const controller &) = delete;
+    controller &operator=(const controller &) = delete;
+
+    /**
+     * @returns  Typed view of channel N, valid while the controller is.
+     */
+    template <int N>
+    auto chan()
+    {
+        static_assert(N >= 0 && N < RPI_PWM_CHANNELS, "no such channel");
+        using S = std::conditional_t<N == 0, Strip0, Strip1>;
+
+        return channel<S>(ws2811_->channel[N], count_[N]);
+    }
+
+    int render()
+    {
+        return ws2811_render(ws2811_.get());
+    }
+
+    int wait()
+    {
+        return ws2811_wait(ws2811_.get());
+    }
+
+    int try_wait()
+    {
+        return ws2811_try_wait(ws2811_.get());
+    }
+
+    int fd()
+    {
+        return ws2811_get_fd(ws2811_.get());
+    }
+
+    ws2811_stats_t stats()
+    {
+        ws2811_stats_t s;
+
+        ws2811_get_stats(ws2811_.get(), &s);
+
+        return s;
+    }
+
+    ws2811_t &native()
+    {
+        return *ws2811_;
+    }
+
+private:
+    template <typename S>
+    static void setup(ws2811_channel_t &chan, const channel_config &config)
+    {
+        if (S::white && config.white_balance)
+        {
+            throw std::invalid_argument("white_balance is not supported on RGBW strips");
+        }
+
+        chan.gpionum = config.gpionum;
+        chan.invert = S::invert;
+        chan.count = S::library_count(config.count);
+        chan.brightness = config.brightness;
+        chan.gamma = config.gamma;
+        chan.white_balance = config.white_balance;
+        chan.leds = nullptr;
+    }
+
+    std::unique_ptr<ws2811_t> ws2811_;
+    std::array<int, RPI_PWM_CHANNELS> count_;
+};
+
+} // namespace ws2811
+
+
+#endif /* __WS2811_HPP__ */